@@ -0,0 +1,220 @@
+/* GStreamer
+ *
+ * Copyright (C) 2016 William Manley <will@williammanley.net>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* Answers questions like "what was p99 between 02:00 and 03:00" from an
+ * archive written by timeoverlayparse archive-location=..., reading only the
+ * blocks that overlap the time range. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+
+#include "latencyarchive.h"
+
+#define NS_PER_SECOND G_GINT64_CONSTANT (1000000000)
+#define DEFAULT_PERCENTILES "50,90,99,99.9"
+
+static gchar *percentiles = NULL;
+
+static GOptionEntry entries[] = {
+  { "percentiles", 'p', 0, G_OPTION_ARG_STRING, &percentiles,
+    "Comma separated percentiles to report (default " DEFAULT_PERCENTILES
+    ")", "LIST" },
+  { NULL }
+};
+
+static gchar *
+format_time (gint64 time)
+{
+  GDateTime *dt = g_date_time_new_from_unix_local (time / NS_PER_SECOND);
+  gchar *s = g_date_time_format (dt, "%Y-%m-%d %H:%M:%S");
+  g_date_time_unref (dt);
+  return s;
+}
+
+/* Accepts seconds since the epoch, an ISO 8601 date and time (local time if
+ * no zone is given) or a bare HH:MM[:SS], which is taken to be on the day
+ * that the archive starts. */
+static gboolean
+parse_time (const gchar * s, gint64 archive_start, gint64 * time)
+{
+  GTimeZone *local = g_time_zone_new_local ();
+  GDateTime *dt = NULL, *day;
+  gchar *end, *iso, *date;
+  gint64 seconds;
+
+  seconds = g_ascii_strtoll (s, &end, 10);
+  if (*s && *end == '\0') {
+    *time = seconds * NS_PER_SECOND;
+    g_time_zone_unref (local);
+    return TRUE;
+  }
+
+  if (strchr (s, 'T') || strchr (s, ' ')) {
+    iso = g_strdelimit (g_strdup (s), " ", 'T');
+    dt = g_date_time_new_from_iso8601 (iso, local);
+    g_free (iso);
+  } else {
+    day = g_date_time_new_from_unix_local (archive_start / NS_PER_SECOND);
+    date = g_date_time_format (day, "%Y-%m-%d");
+    iso = g_strdup_printf ("%sT%s", date, s);
+    dt = g_date_time_new_from_iso8601 (iso, local);
+    g_free (iso);
+    g_free (date);
+    g_date_time_unref (day);
+  }
+  g_time_zone_unref (local);
+
+  if (!dt)
+    return FALSE;
+  *time = g_date_time_to_unix (dt) * NS_PER_SECOND +
+      g_date_time_get_microsecond (dt) * 1000;
+  g_date_time_unref (dt);
+  return TRUE;
+}
+
+static void
+list_blocks (LatencyArchiveReader * reader)
+{
+  const LatencyArchiveBlock *block;
+  gchar *first, *last;
+  guint n;
+
+  printf ("%-19s  %-19s  %7s  %9s  %9s  %9s  %9s  %9s\n", "first", "last",
+      "samples", "min (ms)", "p50", "p99", "p99.9", "max");
+  for (n = 0; n < latency_archive_reader_n_blocks (reader); n++) {
+    block = latency_archive_reader_get_block (reader, n);
+    first = format_time (block->first_time);
+    last = format_time (block->last_time);
+    printf ("%-19s  %-19s  %7u  %9.3f  %9.3f  %9.3f  %9.3f  %9.3f\n",
+        first, last, block->n_samples, block->min_latency / 1e6,
+        block->p50_latency / 1e6, block->p99_latency / 1e6,
+        block->p999_latency / 1e6, block->max_latency / 1e6);
+    g_free (first);
+    g_free (last);
+  }
+}
+
+static int
+compare_gint64 (const void *a, const void *b)
+{
+  gint64 x = *(const gint64 *) a, y = *(const gint64 *) b;
+  return x < y ? -1 : x > y;
+}
+
+static gboolean
+query (LatencyArchiveReader * reader, gint64 from, gint64 to, GError ** err)
+{
+  static gint64 sequences[LATENCY_ARCHIVE_BLOCK_SAMPLES];
+  static gint64 times[LATENCY_ARCHIVE_BLOCK_SAMPLES];
+  static gint64 latencies[LATENCY_ARCHIVE_BLOCK_SAMPLES];
+  const LatencyArchiveBlock *block;
+  GArray *samples = g_array_new (FALSE, FALSE, sizeof (gint64));
+  gchar **p, **list;
+  guint n, i, blocks_read = 0;
+  gint64 *sorted;
+  gdouble percentile;
+  guint rank;
+
+  for (n = 0; n < latency_archive_reader_n_blocks (reader); n++) {
+    block = latency_archive_reader_get_block (reader, n);
+    if (block->last_time < from || block->first_time >= to)
+      continue;
+
+    if (!latency_archive_reader_read_block (reader, n, sequences, times,
+            latencies, err)) {
+      g_array_unref (samples);
+      return FALSE;
+    }
+    blocks_read++;
+    for (i = 0; i < block->n_samples; i++)
+      if (times[i] >= from && times[i] < to)
+        g_array_append_val (samples, latencies[i]);
+  }
+
+  printf ("%u samples from %u of %u blocks\n", samples->len, blocks_read,
+      latency_archive_reader_n_blocks (reader));
+  if (samples->len == 0) {
+    g_array_unref (samples);
+    return TRUE;
+  }
+
+  sorted = (gint64 *) samples->data;
+  qsort (sorted, samples->len, sizeof (gint64), compare_gint64);
+  printf ("min: %.3f ms\n", sorted[0] / 1e6);
+  list = g_strsplit (percentiles ? percentiles : DEFAULT_PERCENTILES, ",", -1);
+  for (p = list; *p; p++) {
+    percentile = g_ascii_strtod (*p, NULL);
+    rank = (guint) (percentile / 100. * samples->len + 0.5);
+    printf ("p%s: %.3f ms\n", *p,
+        sorted[CLAMP (rank, 1, samples->len) - 1] / 1e6);
+  }
+  printf ("max: %.3f ms\n", sorted[samples->len - 1] / 1e6);
+  g_strfreev (list);
+
+  g_array_unref (samples);
+  return TRUE;
+}
+
+int
+main (int argc, char *argv[])
+{
+  GOptionContext *ctx;
+  GError *err = NULL;
+  LatencyArchiveReader *reader;
+  gint64 archive_start = 0, from, to;
+  gboolean ok = TRUE;
+
+  ctx = g_option_context_new ("ARCHIVE [FROM TO]");
+  g_option_context_set_summary (ctx, "Without FROM and TO lists the blocks "
+      "in ARCHIVE, otherwise prints latency percentiles for the frames "
+      "captured between FROM and TO.");
+  g_option_context_add_main_entries (ctx, entries, NULL);
+  if (!g_option_context_parse (ctx, &argc, &argv, &err) ||
+      (argc != 2 && argc != 4)) {
+    fprintf (stderr, "%s\n", err ? err->message :
+        "Usage: archivequery ARCHIVE [FROM TO]");
+    return 1;
+  }
+  g_option_context_free (ctx);
+
+  reader = latency_archive_reader_new (argv[1], &err);
+  if (!reader) {
+    fprintf (stderr, "%s\n", err->message);
+    return 1;
+  }
+  if (latency_archive_reader_n_blocks (reader) > 0)
+    archive_start = latency_archive_reader_get_block (reader, 0)->first_time;
+
+  if (argc == 2) {
+    list_blocks (reader);
+  } else if (!parse_time (argv[2], archive_start, &from) ||
+      !parse_time (argv[3], archive_start, &to)) {
+    fprintf (stderr, "Can't parse time range %s - %s\n", argv[2], argv[3]);
+    ok = FALSE;
+  } else if (!query (reader, from, to, &err)) {
+    fprintf (stderr, "%s\n", err->message);
+    ok = FALSE;
+  }
+
+  latency_archive_reader_free (reader);
+  return ok ? 0 : 1;
+}
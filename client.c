@@ -18,12 +18,105 @@
  * Boston, MA 02110-1301, USA.
  */
 
+#define _GNU_SOURCE
+#include <sched.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <gst/gst.h>
+#include <gio/gio.h>
+#include <gio/gunixsocketaddress.h>
+
+#include "latencystats.h"
+#include "tracewriter.h"
+
+/* Capture caps requested from the source.  In capture-daemon mode the caps
+ * that are actually negotiated are written next to the shared-memory socket
+ * so that analysers attaching later know how to interpret the frames. */
+#define CAPTURE_CAPS "video/x-raw,width=1280,height=720"
+
+static gchar *capture_daemon = NULL;
+static gchar *attach = NULL;
+static gint streams = 1;
+static gchar *decode_mode = NULL;
+static gboolean numa = FALSE;
+static gchar *sysfs_root = "/sys";
+static gchar **stream_devices = NULL;
+static gchar *control_socket = NULL;
+static gchar *export_location = NULL;
+static gdouble export_interval = 1.0;
+static gchar *trace_location = NULL;
+static TraceWriter *trace = NULL;
+static gchar *hls_uri = NULL;
+static GstStructure *hls_settings = NULL;
+static GstElement *hls_pipeline = NULL;
+
+/* How often the per-stream statistics are merged into per-node counters */
+#define NUMA_REPORT_INTERVAL 10
+
+#define MAX_NUMA_NODES 64
+
+/* Indexed by node id.  n_numa_nodes is one more than the highest id. */
+static gint n_numa_nodes = 0;
+static gboolean numa_node_online[MAX_NUMA_NODES];
+static cpu_set_t numa_node_cpus[MAX_NUMA_NODES];
+static gint *stream_node = NULL;
+static GQuark stream_quark;
+
+static GOptionEntry entries[] = {
+  { "capture-daemon", 0, 0, G_OPTION_ARG_FILENAME, &capture_daemon,
+    "Don't analyse the frames, publish them to shared memory for other "
+    "client processes to --attach to", "SOCKET" },
+  { "attach", 0, 0, G_OPTION_ARG_FILENAME, &attach,
+    "Analyse frames published by a --capture-daemon rather than opening the "
+    "capture device.  PIPELINE is then the analysis pipeline to run, by "
+    "default \"timeoverlayparse ! fakesink\"", "SOCKET" },
+  { "streams", 0, 0, G_OPTION_ARG_INT, &streams,
+    "Analyse N streams in this one process.  Any %d in PIPELINE is replaced "
+    "by the stream number, e.g. \"v4l2src device=/dev/video%d\"", "N" },
+  { "decode-mode", 0, 0, G_OPTION_ARG_STRING, &decode_mode,
+    "Where timeoverlayparse decodes the frames: inline, async or pool",
+    "MODE" },
+  { "numa", 0, 0, G_OPTION_ARG_NONE, &numa,
+    "Run each stream's threads on the NUMA node its capture device is "
+    "attached to and report per-node statistics", NULL },
+  { "sysfs-root", 0, 0, G_OPTION_ARG_FILENAME, &sysfs_root,
+    "Read the NUMA topology from DIR instead of /sys, to test with a fake "
+    "topology", "DIR" },
+  { "stream-device", 0, 0, G_OPTION_ARG_FILENAME_ARRAY, &stream_devices,
+    "Capture device of the next stream for NUMA placement.  Defaults to the "
+    "\"device\" property of the stream's source", "DEVICE" },
+  { "control-socket", 0, 0, G_OPTION_ARG_FILENAME, &control_socket,
+    "Keep running and accept commands to start and stop named measurement "
+    "runs on the unix socket PATH", "PATH" },
+  { "export", 0, 0, G_OPTION_ARG_FILENAME, &export_location,
+    "Write a CSV summary of the latency per --export-interval to FILE, for "
+    "plotting.  Any %d is replaced by the stream number", "FILE" },
+  { "export-interval", 0, 0, G_OPTION_ARG_DOUBLE, &export_interval,
+    "Seconds of capture covered by each row of --export (default 1)",
+    "SECONDS" },
+  { "hls", 0, 0, G_OPTION_ARG_STRING, &hls_uri,
+    "Play the HLS stream at URI, e.g. one written by server --hls, as a "
+    "player would, instead of capturing", "URI" },
+  { "trace", 0, 0, G_OPTION_ARG_FILENAME, &trace_location,
+    "Write the times each frame was captured and parsed, and its latency, "
+    "to FILE as a Chrome/Perfetto JSON trace", "FILE" },
+  { NULL }
+};
 
 static gboolean bus_call (GstBus *bus, GstMessage *msg, gpointer data);
+static void write_caps_file (GstPad *pad, GParamSpec *pspec, gpointer data);
+static gboolean set_attach_caps (GstPipeline *pipeline, const gchar *socket_path);
+static gchar *build_analysis_pipeline (const gchar *source_pipeline);
+static void print_stats (GstPipeline *pipeline, gint64 elapsed);
+static gboolean setup_numa (GstPipeline *pipeline);
+static gboolean report_numa (gpointer data);
+static gboolean start_control_socket (const gchar *path);
+static void record_run_latency (GstMessage *msg);
+static void set_export (GstPipeline *pipeline);
+static void trace_frame (GstMessage *msg);
+static void read_hls_settings (const gchar *uri);
 
 int main(int argc, char* argv[])
 {
@@ -33,24 +126,83 @@ int main(int argc, char* argv[])
   GstPipeline * pipeline;
   GstClock* clock;
   GError * err = NULL;
+  GOptionContext *ctx;
   gchar * source_pipeline;
   struct timespec ts;
   int res;
+  gint64 start_time;
 
-  gst_init(&argc, &argv);
+  ctx = g_option_context_new ("[PIPELINE]");
+  g_option_context_add_main_entries (ctx, entries, NULL);
+  g_option_context_add_group (ctx, gst_init_get_option_group ());
+  if (!g_option_context_parse (ctx, &argc, &argv, &err)) {
+    fprintf(stderr, "Error parsing arguments: %s\n", err->message);
+    return 1;
+  }
+  g_option_context_free (ctx);
+
+  if (capture_daemon && attach) {
+    fprintf(stderr, "--capture-daemon and --attach are mutually exclusive\n");
+    return 1;
+  }
+  if (streams < 1 || (streams > 1 && (capture_daemon || attach))) {
+    fprintf(stderr, "--streams must be positive and can't be used with "
+        "--capture-daemon or --attach\n");
+    return 1;
+  }
+  if ((numa || control_socket) && (capture_daemon || attach)) {
+    fprintf(stderr, "--numa and --control-socket can't be used with "
+        "--capture-daemon or --attach\n");
+    return 1;
+  }
+  if (export_location && (capture_daemon || attach)) {
+    fprintf(stderr, "--export can't be used with --capture-daemon or "
+        "--attach, set export-location on timeoverlayparse instead\n");
+    return 1;
+  }
+  if (export_location && streams > 1 && !strstr (export_location, "%d")) {
+    fprintf(stderr, "--export needs a %%d in FILE with --streams\n");
+    return 1;
+  }
+  if (hls_uri && (capture_daemon || attach || streams > 1 || argc > 1)) {
+    fprintf(stderr, "--hls can't be used with PIPELINE, --capture-daemon, "
+        "--attach or --streams\n");
+    return 1;
+  }
+  if (export_interval <= 0) {
+    fprintf(stderr, "--export-interval must be positive\n");
+    return 1;
+  }
 
   loop = g_main_loop_new (NULL, FALSE);
 
   if (argc > 1)
     source_pipeline = argv[1];
+  else if (hls_uri)
+    source_pipeline = g_strdup_printf ("uridecodebin uri=\"%s\"", hls_uri);
+  else if (attach)
+    source_pipeline = "timeoverlayparse ! fakesink";
   else
     source_pipeline = "v4l2src";
 
-  epipeline = gst_parse_launch (g_strdup_printf (
-      "%s "
-      "! video/x-raw,width=1280,height=720 "
-      "! timeoverlayparse "
-      "! fakesink", source_pipeline), &err);
+  if (capture_daemon) {
+    /* shmsink keeps each frame in the shared-memory area until every
+     * attached analyser has released it, and drops analysers that go away so
+     * a crashing analyser can't stall capture or the other analysers. */
+    epipeline = gst_parse_launch (g_strdup_printf (
+        "%s "
+        "! " CAPTURE_CAPS " "
+        "! shmsink name=shmsink socket-path=%s wait-for-connection=false "
+        "    sync=false", source_pipeline, capture_daemon), &err);
+  } else if (attach) {
+    epipeline = gst_parse_launch (g_strdup_printf (
+        "shmsrc socket-path=%s is-live=true do-timestamp=true "
+        "! capsfilter name=shmcaps "
+        "! %s", attach, source_pipeline), &err);
+  } else {
+    epipeline = gst_parse_launch (build_analysis_pipeline (source_pipeline),
+        &err);
+  }
 
   if (err) {
     fprintf(stderr, "Error creating pipeline: %s\n", err->message);
@@ -59,6 +211,41 @@ int main(int argc, char* argv[])
   g_return_val_if_fail (epipeline != NULL, 1);
   pipeline = GST_PIPELINE(epipeline);
 
+  if (capture_daemon) {
+    GstElement *shmsink = gst_bin_get_by_name (GST_BIN (pipeline), "shmsink");
+    GstPad *pad = gst_element_get_static_pad (shmsink, "sink");
+    g_signal_connect (pad, "notify::caps", G_CALLBACK (write_caps_file),
+        capture_daemon);
+    gst_object_unref (pad);
+    gst_object_unref (shmsink);
+  } else if (attach && !set_attach_caps (pipeline, attach)) {
+    return 1;
+  } else if (numa) {
+    if (!setup_numa (pipeline))
+      return 1;
+    g_timeout_add_seconds (NUMA_REPORT_INTERVAL, report_numa, pipeline);
+  }
+
+  if (control_socket && !start_control_socket (control_socket))
+    return 1;
+
+  if (hls_uri) {
+    read_hls_settings (hls_uri);
+    hls_pipeline = epipeline;
+  }
+
+  if (export_location)
+    set_export (pipeline);
+
+  if (trace_location) {
+    trace = trace_writer_new (trace_location, "client", &err);
+    if (!trace) {
+      fprintf(stderr, "%s\n", err->message);
+      return 1;
+    }
+    trace_writer_add_pipeline (trace, GST_BIN (pipeline), "capture");
+  }
+
   /* we add a message handler */
   bus = gst_pipeline_get_bus (GST_PIPELINE (pipeline));
   gst_bus_add_watch (bus, bus_call, loop);
@@ -73,10 +260,22 @@ int main(int argc, char* argv[])
   res = clock_gettime(CLOCK_REALTIME, &ts);
   g_return_val_if_fail (res == 0, 1);
 
+  start_time = g_get_monotonic_time ();
   gst_element_set_state(epipeline, GST_STATE_PLAYING);
 
   g_main_loop_run (loop);
 
+  /* Stopping timeoverlayparse waits for any frames it still has queued */
+  gst_element_set_state(epipeline, GST_STATE_NULL);
+  if (!capture_daemon && !attach)
+    print_stats (pipeline, g_get_monotonic_time () - start_time);
+  if (numa)
+    report_numa (pipeline);
+  if (trace && !trace_writer_close (trace, &err)) {
+    fprintf(stderr, "%s\n", err->message);
+    return 1;
+  }
+
   return 0;
 }
 
@@ -105,9 +304,786 @@ bus_call (GstBus *bus, GstMessage *msg, gpointer data)
       exit (1);
       break;
     }
+    case GST_MESSAGE_BUFFERING: {
+      gint percent;
+
+      /* Like a player, wait for the buffer to refill rather than playing
+       * through an underrun.  The time spent waiting ends up in the
+       * latency of the frames that follow. */
+      if (!hls_pipeline)
+        break;
+      gst_message_parse_buffering (msg, &percent);
+      gst_element_set_state (hls_pipeline,
+          percent < 100 ? GST_STATE_PAUSED : GST_STATE_PLAYING);
+      break;
+    }
+    case GST_MESSAGE_ELEMENT:
+      if (gst_message_has_name (msg, "timeoverlayparse")) {
+        record_run_latency (msg);
+        if (trace)
+          trace_frame (msg);
+      }
+      break;
     default:
       break;
   }
 
   return TRUE;
 }
+
+static gchar *
+caps_file_name (const gchar *socket_path)
+{
+  return g_strdup_printf ("%s.caps", socket_path);
+}
+
+/* Called on the streaming thread when the capture caps are (re)negotiated */
+static void
+write_caps_file (GstPad *pad, GParamSpec *pspec, gpointer data)
+{
+  const gchar *socket_path = data;
+  GstCaps *caps;
+  gchar *filename, *str;
+  GError *err = NULL;
+
+  caps = gst_pad_get_current_caps (pad);
+  if (!caps)
+    return;
+
+  filename = caps_file_name (socket_path);
+  str = gst_caps_to_string (caps);
+  if (!g_file_set_contents (filename, str, -1, &err)) {
+    g_printerr ("Failed to write capture caps to %s: %s\n", filename,
+        err->message);
+    g_clear_error (&err);
+  }
+
+  g_free (str);
+  g_free (filename);
+  gst_caps_unref (caps);
+}
+
+/* shmsrc only transports the frame data, so the analyser has to be told
+ * the caps the capture daemon negotiated */
+static gboolean
+set_attach_caps (GstPipeline *pipeline, const gchar *socket_path)
+{
+  GstElement *capsfilter;
+  GstCaps *caps;
+  gchar *filename, *str = NULL;
+  GError *err = NULL;
+
+  filename = caps_file_name (socket_path);
+  if (!g_file_get_contents (filename, &str, NULL, &err)) {
+    g_printerr ("Failed to read capture caps: %s.  Is a client running with "
+        "--capture-daemon=%s?\n", err->message, socket_path);
+    g_clear_error (&err);
+    g_free (filename);
+    return FALSE;
+  }
+  g_free (filename);
+
+  caps = gst_caps_from_string (g_strstrip (str));
+  g_free (str);
+  if (!caps) {
+    g_printerr ("Invalid capture caps for %s\n", socket_path);
+    return FALSE;
+  }
+
+  capsfilter = gst_bin_get_by_name (GST_BIN (pipeline), "shmcaps");
+  g_object_set (capsfilter, "caps", caps, NULL);
+  gst_object_unref (capsfilter);
+  gst_caps_unref (caps);
+  return TRUE;
+}
+
+/* One source ! timeoverlayparse ! fakesink chain per stream, with the
+ * parsers named parse0, parse1, ... */
+static gchar *
+build_analysis_pipeline (const gchar *source_pipeline)
+{
+  GString *desc = g_string_new (NULL);
+  gchar **parts = g_strsplit (source_pipeline, "%d", -1);
+  gint n;
+
+  for (n = 0; n < streams; n++) {
+    gchar *index = g_strdup_printf ("%d", n);
+    gchar *source = g_strjoinv (index, parts);
+
+    /* A played-back stream comes at whatever size it was encoded at, and
+     * the frames are only seen at the time they would be displayed */
+    g_string_append_printf (desc,
+        "%s "
+        "! %s "
+        "! timeoverlayparse name=parse%d %s%s %s "
+        "! fakesink sync=%s ", source, hls_uri ? "video/x-raw" : CAPTURE_CAPS,
+        n, decode_mode ? "decode-mode=" : "", decode_mode ? decode_mode : "",
+        control_socket || trace_location ? "post-messages=true" : "",
+        hls_uri ? "true" : "false");
+
+    g_free (source);
+    g_free (index);
+  }
+
+  g_strfreev (parts);
+  return g_string_free (desc, FALSE);
+}
+
+static void
+set_export (GstPipeline *pipeline)
+{
+  gchar **parts = g_strsplit (export_location, "%d", -1);
+  GstElement *parse;
+  gchar *name, *index, *location;
+  gint n;
+
+  for (n = 0; n < streams; n++) {
+    name = g_strdup_printf ("parse%d", n);
+    parse = gst_bin_get_by_name (GST_BIN (pipeline), name);
+    g_free (name);
+    if (!parse)
+      continue;
+
+    index = g_strdup_printf ("%d", n);
+    location = g_strjoinv (index, parts);
+    g_object_set (parse, "export-location", location,
+        "export-interval", (guint64) (export_interval * GST_SECOND), NULL);
+    g_free (location);
+    g_free (index);
+    gst_object_unref (parse);
+  }
+
+  g_strfreev (parts);
+}
+
+/* The pipeline clock is REALTIME, so each frame's latency can go on the
+ * same timeline as the server's trace: from when it was due on screen to
+ * when it was captured.  Decoding is traced from here too rather than by
+ * the pipeline's pad probes, because with an async or pool decode-mode it
+ * finishes after the buffer has left timeoverlayparse. */
+static void
+trace_frame (GstMessage *msg)
+{
+  const GstStructure *s = gst_message_get_structure (msg);
+  const gchar *element =
+      g_intern_string (GST_OBJECT_NAME (GST_MESSAGE_SRC (msg)));
+  guint64 clock_time, render_realtime, processing, decoded_realtime;
+  gint64 sequence = -1;
+
+  if (!gst_structure_get_uint64 (s, "clock-time", &clock_time) ||
+      !gst_structure_get_uint64 (s, "render-realtime", &render_realtime))
+    return;
+  gst_structure_get_int64 (s, "sequence", &sequence);
+
+  trace_writer_add_span (trace, "latency", element, render_realtime / 1000,
+      ((gint64) clock_time - (gint64) render_realtime) / 1000, "sequence",
+      sequence);
+  if (gst_structure_get_uint64 (s, "processing-time", &processing) &&
+      gst_structure_get_uint64 (s, "decoded-realtime", &decoded_realtime))
+    trace_writer_add_span (trace, "parse", element,
+        (decoded_realtime - processing) / 1000, processing / 1000,
+        "sequence", sequence);
+}
+
+static gboolean
+copy_field (GQuark field, const GValue *value, gpointer user_data)
+{
+  gst_structure_id_set_value (user_data, field, value);
+  return TRUE;
+}
+
+static void
+append_buffer (GstElement *sink, GstBuffer *buffer, GstPad *pad,
+    gpointer user_data)
+{
+  GstMapInfo map;
+
+  if (gst_buffer_map (buffer, &map, GST_MAP_READ)) {
+    g_byte_array_append (user_data, map.data, map.size);
+    gst_buffer_unmap (buffer, &map);
+  }
+}
+
+/* Reads the whole resource at URI with whichever GStreamer source handles
+ * it, so that http:// works the same as it does for the stream itself and
+ * without GIO's gvfs backends.  Returns a nul-terminated string. */
+static gchar *
+read_uri_contents (const gchar *uri, GError **err)
+{
+  GstElement *pipeline, *src, *sink;
+  GByteArray *contents;
+  GstMessage *msg;
+  GstBus *bus;
+
+  src = gst_element_make_from_uri (GST_URI_SRC, uri, NULL, err);
+  if (!src)
+    return NULL;
+
+  contents = g_byte_array_new ();
+  pipeline = gst_pipeline_new (NULL);
+  sink = gst_element_factory_make ("fakesink", NULL);
+  g_object_set (sink, "signal-handoffs", TRUE, "sync", FALSE, NULL);
+  g_signal_connect (sink, "handoff", G_CALLBACK (append_buffer), contents);
+  gst_bin_add_many (GST_BIN (pipeline), src, sink, NULL);
+  gst_element_link (src, sink);
+
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+  bus = gst_element_get_bus (pipeline);
+  msg = gst_bus_timed_pop_filtered (bus, 10 * GST_SECOND,
+      GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+
+  if (!msg) {
+    g_set_error (err, GST_RESOURCE_ERROR, GST_RESOURCE_ERROR_READ,
+        "Timed out reading %s", uri);
+  } else if (GST_MESSAGE_TYPE (msg) == GST_MESSAGE_ERROR) {
+    if (err)
+      gst_message_parse_error (msg, err, NULL);
+  }
+  gst_object_unref (bus);
+  gst_object_unref (pipeline);
+
+  if (!msg || GST_MESSAGE_TYPE (msg) == GST_MESSAGE_ERROR) {
+    if (msg)
+      gst_message_unref (msg);
+    g_byte_array_free (contents, TRUE);
+    return NULL;
+  }
+  gst_message_unref (msg);
+  g_byte_array_append (contents, (const guint8 *) "", 1);
+  return (gchar *) g_byte_array_free (contents, FALSE);
+}
+
+/* server --hls writes its segment and part durations next to the playlist
+ * so that the statistics of each run say which settings they are for */
+static void
+read_hls_settings (const gchar *uri)
+{
+  gchar *settings_uri = g_strdup_printf ("%s.settings", uri);
+  gchar *contents;
+  GError *err = NULL;
+
+  if (!(contents = read_uri_contents (settings_uri, &err))) {
+    g_printerr ("Can't read HLS settings from %s, statistics won't be "
+        "labelled with them: %s\n", settings_uri, err->message);
+    g_clear_error (&err);
+  } else if (!(hls_settings = gst_structure_from_string (g_strstrip (contents),
+              NULL))) {
+    g_printerr ("Invalid HLS settings in %s\n", settings_uri);
+  }
+
+  g_free (contents);
+  g_free (settings_uri);
+}
+
+static void
+print_stats (GstPipeline *pipeline, gint64 elapsed)
+{
+  guint64 frames, total_frames = 0;
+  GstStructure *stats;
+  GstElement *parse;
+  gchar *name, *str;
+  gint n;
+
+  for (n = 0; n < streams; n++) {
+    name = g_strdup_printf ("parse%d", n);
+    parse = gst_bin_get_by_name (GST_BIN (pipeline), name);
+    g_free (name);
+    if (!parse)
+      continue;
+
+    g_object_get (parse, "stats", &stats, NULL);
+    if (gst_structure_get_uint64 (stats, "processing-count", &frames))
+      total_frames += frames;
+    if (hls_settings)
+      gst_structure_foreach (hls_settings, copy_field, stats);
+    str = gst_structure_to_string (stats);
+    g_print ("Stream %d: %s\n", n, str);
+    g_free (str);
+    gst_structure_free (stats);
+    gst_object_unref (parse);
+  }
+
+  g_print ("Decoded %" G_GUINT64_FORMAT " frames from %d streams in %.3fs "
+      "(%.1f frames/s)\n", total_frames, streams, elapsed / 1e6,
+      total_frames * 1e6 / MAX (elapsed, 1));
+}
+
+/* Parses a sysfs cpulist or nodelist such as "0-3,8-11" */
+static gboolean
+read_list (const gchar *filename, cpu_set_t *set)
+{
+  gchar *contents;
+  gchar **ranges;
+  gint n, first, last, i;
+
+  if (!g_file_get_contents (filename, &contents, NULL, NULL))
+    return FALSE;
+
+  CPU_ZERO (set);
+  ranges = g_strsplit (g_strstrip (contents), ",", -1);
+  for (n = 0; ranges[n]; n++) {
+    switch (sscanf (ranges[n], "%d-%d", &first, &last)) {
+      case 1:
+        last = first;
+        /* fall through */
+      case 2:
+        for (i = first; i <= last && i < CPU_SETSIZE; i++)
+          CPU_SET (i, set);
+        break;
+      default:
+        break;
+    }
+  }
+  g_strfreev (ranges);
+  g_free (contents);
+  return TRUE;
+}
+
+static gboolean
+read_node_cpus (gint node, cpu_set_t *cpus)
+{
+  gchar *filename;
+  gboolean ok;
+
+  filename = g_strdup_printf ("%s/devices/system/node/node%d/cpulist",
+      sysfs_root, node);
+  ok = read_list (filename, cpus);
+  g_free (filename);
+  return ok;
+}
+
+/* Node ids needn't be contiguous, e.g. "0,2" with node 1 offline or
+ * absent, so they are taken from the node list rather than counted */
+static gboolean
+read_online_nodes (cpu_set_t *nodes)
+{
+  static const gchar *lists[] = { "online", "possible" };
+  gchar *filename;
+  gboolean ok = FALSE;
+  guint n;
+
+  for (n = 0; n < G_N_ELEMENTS (lists) && !ok; n++) {
+    filename = g_strdup_printf ("%s/devices/system/node/%s", sysfs_root,
+        lists[n]);
+    ok = read_list (filename, nodes);
+    g_free (filename);
+  }
+  return ok;
+}
+
+/* -1 if the device isn't known to sysfs or isn't attached to a node */
+static gint
+device_numa_node (const gchar *device)
+{
+  gchar *basename, *filename, *contents;
+  gint node = -1;
+
+  basename = g_path_get_basename (device);
+  filename = g_strdup_printf ("%s/class/video4linux/%s/device/numa_node",
+      sysfs_root, basename);
+  if (g_file_get_contents (filename, &contents, NULL, NULL)) {
+    node = atoi (contents);
+    g_free (contents);
+  }
+  g_free (filename);
+  g_free (basename);
+
+  return node >= 0 && node < n_numa_nodes && numa_node_online[node] ? node :
+      -1;
+}
+
+/* Tags every element of stream n, from the parser up to the source, with
+ * the stream number and returns the source */
+static GstElement *
+tag_stream_elements (GstElement *element, gint n)
+{
+  GstPad *sinkpad, *peer;
+  GstElement *upstream;
+
+  gst_object_ref (element);
+  while (TRUE) {
+    g_object_set_qdata (G_OBJECT (element), stream_quark,
+        GINT_TO_POINTER (n + 1));
+
+    sinkpad = gst_element_get_static_pad (element, "sink");
+    peer = sinkpad ? gst_pad_get_peer (sinkpad) : NULL;
+    upstream = peer ? gst_pad_get_parent_element (peer) : NULL;
+    g_clear_object (&peer);
+    g_clear_object (&sinkpad);
+    if (!upstream)
+      return element;
+
+    gst_object_unref (element);
+    element = upstream;
+  }
+}
+
+static gint
+element_stream (GstElement *element)
+{
+  GstObject *obj;
+  gint n;
+
+  for (obj = GST_OBJECT (element); obj; obj = GST_OBJECT_PARENT (obj)) {
+    n = GPOINTER_TO_INT (g_object_get_qdata (G_OBJECT (obj), stream_quark));
+    if (n)
+      return n - 1;
+  }
+  return -1;
+}
+
+/* Streaming threads post ENTER from the thread itself, so we can pin them
+ * before they process any data */
+static GstBusSyncReply
+numa_sync_handler (GstBus *bus, GstMessage *msg, gpointer data)
+{
+  GstStreamStatusType type;
+  GstElement *owner;
+  gint n;
+
+  if (GST_MESSAGE_TYPE (msg) != GST_MESSAGE_STREAM_STATUS)
+    return GST_BUS_PASS;
+
+  gst_message_parse_stream_status (msg, &type, &owner);
+  if (type != GST_STREAM_STATUS_TYPE_ENTER)
+    return GST_BUS_PASS;
+
+  n = element_stream (owner);
+  if (n >= 0 && stream_node[n] >= 0) {
+    if (sched_setaffinity (0, sizeof (cpu_set_t),
+            &numa_node_cpus[stream_node[n]]) != 0)
+      g_printerr ("Failed to pin %s of stream %d to node %d\n",
+          GST_OBJECT_NAME (owner), n, stream_node[n]);
+  }
+  return GST_BUS_PASS;
+}
+
+static gboolean
+setup_numa (GstPipeline *pipeline)
+{
+  GstElement *parse, *source;
+  gchar *name, *device;
+  cpu_set_t nodes;
+  GstBus *bus;
+  gint n;
+
+  if (!read_online_nodes (&nodes)) {
+    g_printerr ("Can't read the NUMA node list from "
+        "%s/devices/system/node/online\n", sysfs_root);
+    return FALSE;
+  }
+  for (n = 0; n < MAX_NUMA_NODES; n++) {
+    if (CPU_ISSET (n, &nodes) && read_node_cpus (n, &numa_node_cpus[n])) {
+      numa_node_online[n] = TRUE;
+      n_numa_nodes = n + 1;
+    }
+  }
+  if (n_numa_nodes == 0) {
+    g_printerr ("No NUMA nodes found in %s/devices/system/node\n",
+        sysfs_root);
+    return FALSE;
+  }
+
+  stream_quark = g_quark_from_static_string ("latency-clock-stream");
+  stream_node = g_new (gint, streams);
+
+  for (n = 0; n < streams; n++) {
+    name = g_strdup_printf ("parse%d", n);
+    parse = gst_bin_get_by_name (GST_BIN (pipeline), name);
+    g_free (name);
+    source = tag_stream_elements (parse, n);
+    gst_object_unref (parse);
+
+    device = NULL;
+    if (stream_devices && n < g_strv_length (stream_devices))
+      device = g_strdup (stream_devices[n]);
+    else if (g_object_class_find_property (G_OBJECT_GET_CLASS (source),
+            "device"))
+      g_object_get (source, "device", &device, NULL);
+    gst_object_unref (source);
+
+    stream_node[n] = device ? device_numa_node (device) : -1;
+    g_print ("Stream %d: device %s, NUMA node %d\n", n,
+        device ? device : "unknown", stream_node[n]);
+    g_free (device);
+  }
+
+  bus = gst_pipeline_get_bus (pipeline);
+  gst_bus_set_sync_handler (bus, numa_sync_handler, NULL, NULL);
+  gst_object_unref (bus);
+  return TRUE;
+}
+
+typedef struct {
+  gint streams;
+  guint64 frames;
+  guint64 decoded;
+  gdouble latency_sum;
+  gint64 latency_min;
+  gint64 latency_max;
+} NodeCounters;
+
+/* Streams only ever update their own statistics.  Merging them per node
+ * happens here, on the main thread, once every NUMA_REPORT_INTERVAL. */
+static gboolean
+report_numa (gpointer data)
+{
+  GstPipeline *pipeline = data;
+  NodeCounters *nodes;
+  GstStructure *stats;
+  GstElement *parse;
+  guint64 count;
+  gint64 value;
+  gchar *name;
+  gint n, node;
+
+  /* The last entry is for streams on an unknown node */
+  nodes = g_new0 (NodeCounters, n_numa_nodes + 1);
+  for (node = 0; node <= n_numa_nodes; node++) {
+    nodes[node].latency_min = G_MAXINT64;
+    nodes[node].latency_max = G_MININT64;
+  }
+
+  for (n = 0; n < streams; n++) {
+    name = g_strdup_printf ("parse%d", n);
+    parse = gst_bin_get_by_name (GST_BIN (pipeline), name);
+    g_free (name);
+    if (!parse)
+      continue;
+    g_object_get (parse, "stats", &stats, NULL);
+    gst_object_unref (parse);
+
+    node = stream_node[n] >= 0 ? stream_node[n] : n_numa_nodes;
+    nodes[node].streams++;
+    if (gst_structure_get_uint64 (stats, "processing-count", &count))
+      nodes[node].frames += count;
+    if (gst_structure_get_uint64 (stats, "latency-count", &count) &&
+        count > 0) {
+      nodes[node].decoded += count;
+      if (gst_structure_get_int64 (stats, "latency-mean", &value))
+        nodes[node].latency_sum += (gdouble) value * count;
+      if (gst_structure_get_int64 (stats, "latency-min", &value))
+        nodes[node].latency_min = MIN (nodes[node].latency_min, value);
+      if (gst_structure_get_int64 (stats, "latency-max", &value))
+        nodes[node].latency_max = MAX (nodes[node].latency_max, value);
+    }
+    gst_structure_free (stats);
+  }
+
+  for (node = 0; node <= n_numa_nodes; node++) {
+    if (nodes[node].streams == 0)
+      continue;
+    if (node < n_numa_nodes)
+      g_print ("NUMA node %d: ", node);
+    else
+      g_print ("NUMA node unknown: ");
+    g_print ("%d streams, %" G_GUINT64_FORMAT " frames, %" G_GUINT64_FORMAT
+        " decoded", nodes[node].streams, nodes[node].frames,
+        nodes[node].decoded);
+    if (nodes[node].decoded > 0)
+      g_print (", latency min %" GST_STIME_FORMAT " mean %" GST_STIME_FORMAT
+          " max %" GST_STIME_FORMAT,
+          GST_STIME_ARGS (nodes[node].latency_min),
+          GST_STIME_ARGS ((gint64) (nodes[node].latency_sum /
+                  nodes[node].decoded)),
+          GST_STIME_ARGS (nodes[node].latency_max));
+    g_print ("\n");
+  }
+
+  g_free (nodes);
+  return G_SOURCE_CONTINUE;
+}
+
+/* A named measurement run started over the control socket.  Runs can
+ * overlap, every frame decoded is recorded in all the runs in progress. */
+typedef struct {
+  gchar *name;
+  gint64 start_time;
+  LatencyHistogram *latency;
+  GString *marks;
+} Run;
+
+static GHashTable *runs = NULL;
+
+static void
+run_free (Run *run)
+{
+  g_free (run->name);
+  latency_histogram_free (run->latency);
+  g_string_free (run->marks, TRUE);
+  g_free (run);
+}
+
+static void
+record_run_latency (GstMessage *msg)
+{
+  const GstStructure *s = gst_message_get_structure (msg);
+  GHashTableIter iter;
+  gint64 latency;
+  Run *run;
+
+  if (!runs || !gst_structure_get_int64 (s, "latency", &latency))
+    return;
+
+  g_hash_table_iter_init (&iter, runs);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &run))
+    latency_histogram_record (run->latency, latency);
+}
+
+static gchar *
+run_stats (Run *run)
+{
+  GstStructure *s;
+  gchar *str;
+
+  s = gst_structure_new ("run",
+      "name", G_TYPE_STRING, run->name,
+      "duration", G_TYPE_INT64,
+          (g_get_monotonic_time () - run->start_time) * GST_USECOND,
+      "marks", G_TYPE_STRING, run->marks->str, NULL);
+  latency_histogram_to_structure (run->latency, s, "latency");
+  str = gst_structure_to_string (s);
+  gst_structure_free (s);
+  return str;
+}
+
+/* Commands are a line each and get a line in reply starting with OK or
+ * ERROR:
+ *   start NAME        start recording a new run
+ *   mark NAME LABEL   note the time and frame count within the run
+ *   stats NAME        statistics of the run so far
+ *   stop NAME         statistics of the run, which is then forgotten
+ *   list              names of the runs in progress */
+static gchar *
+control_command (const gchar *line)
+{
+  gchar **args = g_strsplit (line, " ", 3);
+  guint argc = g_strv_length (args);
+  gchar *reply, *stats;
+  GHashTableIter iter;
+  GString *names;
+  Run *run = NULL;
+
+  if (argc >= 2)
+    run = g_hash_table_lookup (runs, args[1]);
+
+  if (argc == 2 && strcmp (args[0], "start") == 0) {
+    if (run) {
+      reply = g_strdup_printf ("ERROR run %s already started", args[1]);
+    } else {
+      run = g_new0 (Run, 1);
+      run->name = g_strdup (args[1]);
+      run->start_time = g_get_monotonic_time ();
+      run->latency = latency_histogram_new ();
+      run->marks = g_string_new (NULL);
+      g_hash_table_insert (runs, run->name, run);
+      reply = g_strdup ("OK");
+    }
+  } else if (argc == 1 && strcmp (args[0], "list") == 0) {
+    names = g_string_new ("OK");
+    g_hash_table_iter_init (&iter, runs);
+    while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &run))
+      g_string_append_printf (names, " %s", run->name);
+    reply = g_string_free (names, FALSE);
+  } else if (argc < 2 || (argc == 3) != (strcmp (args[0], "mark") == 0)) {
+    reply = g_strdup ("ERROR usage: start NAME | mark NAME LABEL | "
+        "stats NAME | stop NAME | list");
+  } else if (!run) {
+    reply = g_strdup_printf ("ERROR no run called %s", args[1]);
+  } else if (strcmp (args[0], "mark") == 0) {
+    g_string_append_printf (run->marks, "%s%s@%" G_GINT64_FORMAT "us/%"
+        G_GUINT64_FORMAT, run->marks->len ? " " : "", args[2],
+        g_get_monotonic_time () - run->start_time, run->latency->count);
+    reply = g_strdup ("OK");
+  } else if (strcmp (args[0], "stats") == 0) {
+    stats = run_stats (run);
+    reply = g_strdup_printf ("OK %s", stats);
+    g_free (stats);
+  } else if (strcmp (args[0], "stop") == 0) {
+    stats = run_stats (run);
+    reply = g_strdup_printf ("OK %s", stats);
+    g_free (stats);
+    g_hash_table_remove (runs, args[1]);
+  } else {
+    reply = g_strdup_printf ("ERROR unknown command %s", args[0]);
+  }
+
+  g_strfreev (args);
+  return reply;
+}
+
+static void
+control_read_line (GObject *source, GAsyncResult *res, gpointer data)
+{
+  GDataInputStream *in = G_DATA_INPUT_STREAM (source);
+  GIOStream *connection = data;
+  gchar *line, *reply;
+
+  line = g_data_input_stream_read_line_finish (in, res, NULL, NULL);
+  if (!line) {
+    /* Client went away */
+    g_object_unref (in);
+    g_object_unref (connection);
+    return;
+  }
+
+  reply = control_command (g_strstrip (line));
+  g_free (line);
+  if (!g_output_stream_write_all (g_io_stream_get_output_stream (connection),
+          reply, strlen (reply), NULL, NULL, NULL) ||
+      !g_output_stream_write_all (g_io_stream_get_output_stream (connection),
+          "\n", 1, NULL, NULL, NULL)) {
+    g_free (reply);
+    g_object_unref (in);
+    g_object_unref (connection);
+    return;
+  }
+  g_free (reply);
+
+  g_data_input_stream_read_line_async (in, G_PRIORITY_DEFAULT, NULL,
+      control_read_line, connection);
+}
+
+static gboolean
+control_incoming (GSocketService *service, GSocketConnection *connection,
+    GObject *source_object, gpointer data)
+{
+  GDataInputStream *in;
+
+  in = g_data_input_stream_new (
+      g_io_stream_get_input_stream (G_IO_STREAM (connection)));
+  g_data_input_stream_read_line_async (in, G_PRIORITY_DEFAULT, NULL,
+      control_read_line, g_object_ref (connection));
+  return TRUE;
+}
+
+/* Commands are handled on the main loop, as are the element messages from
+ * the parsers that feed the runs */
+static gboolean
+start_control_socket (const gchar *path)
+{
+  GSocketService *service;
+  GSocketAddress *address;
+  GError *err = NULL;
+
+  runs = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+      (GDestroyNotify) run_free);
+
+  unlink (path);
+  service = g_socket_service_new ();
+  address = g_unix_socket_address_new (path);
+  if (!g_socket_listener_add_address (G_SOCKET_LISTENER (service), address,
+          G_SOCKET_TYPE_STREAM, G_SOCKET_PROTOCOL_DEFAULT, NULL, NULL, &err)) {
+    g_printerr ("Failed to listen on %s: %s\n", path, err->message);
+    g_clear_error (&err);
+    g_object_unref (address);
+    g_object_unref (service);
+    return FALSE;
+  }
+  g_object_unref (address);
+
+  g_signal_connect (service, "incoming", G_CALLBACK (control_incoming), NULL);
+  g_socket_service_start (service);
+  return TRUE;
+}
@@ -69,13 +69,15 @@ def test_measure_latency():
 
 
 def read_timestamps(frame):
-    startline = (frame.shape[0] - NUM_TIMESTAMPS * SQUARE_SIZE) // 2
+    # Starts on an even line and column, as timestampoverlay draws it
+    startline = (frame.shape[0] - NUM_TIMESTAMPS * SQUARE_SIZE) // 2 & ~1
     endline = startline + NUM_TIMESTAMPS * SQUARE_SIZE
-    startcol = (frame.shape[1] - NUM_SQUARES * SQUARE_SIZE) // 2
+    startcol = (frame.shape[1] - NUM_SQUARES * SQUARE_SIZE) // 2 & ~1
     endcol = startcol + NUM_SQUARES * SQUARE_SIZE
 
     bits = numpy.packbits(
-        (frame[startline:endline:8, startcol:endcol:8, 0] & 0x80),
+        (frame[startline:endline:SQUARE_SIZE, startcol:endcol:SQUARE_SIZE, 0] &
+         0x80),
         axis=1)
     timestamps = numpy.fromstring(bits.data, dtype=">u8").astype(float) / 1e9
     return timestamps.view(dtype=VIDEO_TIMESTAMPS)
@@ -0,0 +1,219 @@
+/* GStreamer
+ * Copyright (C) 2016 William Manley <will@williammanley.net>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "decodepool.h"
+
+typedef struct {
+  GMutex lock;
+  GQueue streams;
+} Worker;
+
+typedef struct {
+  guint n_workers;
+  Worker *workers;
+
+  /* Number of streams sitting on any worker's deque.  Idle workers sleep on
+   * cond until it becomes non-zero. */
+  gint queued;
+  GMutex lock;
+  GCond cond;
+
+  guint next_home;
+} DecodePool;
+
+struct _DecodePoolStream {
+  DecodePoolFunc func;
+  gpointer user_data;
+  guint home;
+
+  GMutex lock;
+  GCond idle;
+  GQueue jobs;
+  guint pending;
+  /* TRUE while the stream is on a deque or being run by a worker, which
+   * guarantees that only one worker runs its jobs at a time */
+  gboolean scheduled;
+};
+
+static DecodePool *pool;
+
+static void
+enqueue_stream (guint worker, DecodePoolStream * stream)
+{
+  g_mutex_lock (&pool->workers[worker].lock);
+  g_queue_push_tail (&pool->workers[worker].streams, stream);
+  g_mutex_unlock (&pool->workers[worker].lock);
+
+  g_atomic_int_inc (&pool->queued);
+  g_mutex_lock (&pool->lock);
+  g_cond_signal (&pool->cond);
+  g_mutex_unlock (&pool->lock);
+}
+
+/* Own deque from the front, other deques from the back */
+static DecodePoolStream *
+dequeue_stream (guint self)
+{
+  DecodePoolStream *stream;
+  guint n, victim;
+
+  for (n = 0; n < pool->n_workers; n++) {
+    victim = (self + n) % pool->n_workers;
+    g_mutex_lock (&pool->workers[victim].lock);
+    if (victim == self)
+      stream = g_queue_pop_head (&pool->workers[victim].streams);
+    else
+      stream = g_queue_pop_tail (&pool->workers[victim].streams);
+    g_mutex_unlock (&pool->workers[victim].lock);
+
+    if (stream) {
+      g_atomic_int_add (&pool->queued, -1);
+      return stream;
+    }
+  }
+  return NULL;
+}
+
+/* Runs one job and then puts the stream to the back of our own deque, so a
+ * busy stream can't starve the others */
+static void
+run_stream (guint self, DecodePoolStream * stream)
+{
+  gpointer job;
+
+  g_mutex_lock (&stream->lock);
+  job = g_queue_pop_head (&stream->jobs);
+  g_mutex_unlock (&stream->lock);
+
+  stream->func (job, stream->user_data);
+
+  g_mutex_lock (&stream->lock);
+  stream->pending--;
+  if (g_queue_is_empty (&stream->jobs)) {
+    stream->scheduled = FALSE;
+    g_cond_broadcast (&stream->idle);
+    g_mutex_unlock (&stream->lock);
+  } else {
+    g_mutex_unlock (&stream->lock);
+    enqueue_stream (self, stream);
+  }
+}
+
+static gpointer
+worker_thread (gpointer data)
+{
+  guint self = GPOINTER_TO_UINT (data);
+  DecodePoolStream *stream;
+
+  while (TRUE) {
+    stream = dequeue_stream (self);
+    if (stream) {
+      run_stream (self, stream);
+      continue;
+    }
+
+    g_mutex_lock (&pool->lock);
+    while (g_atomic_int_get (&pool->queued) == 0)
+      g_cond_wait (&pool->cond, &pool->lock);
+    g_mutex_unlock (&pool->lock);
+  }
+  return NULL;
+}
+
+/* The pool lives for the rest of the process once created */
+static gpointer
+create_pool (gpointer data)
+{
+  DecodePool *p;
+  guint n;
+
+  p = g_new0 (DecodePool, 1);
+  p->n_workers = g_get_num_processors ();
+  p->workers = g_new0 (Worker, p->n_workers);
+  g_mutex_init (&p->lock);
+  g_cond_init (&p->cond);
+  for (n = 0; n < p->n_workers; n++) {
+    g_mutex_init (&p->workers[n].lock);
+    g_queue_init (&p->workers[n].streams);
+  }
+  pool = p;
+
+  for (n = 0; n < p->n_workers; n++) {
+    gchar *name = g_strdup_printf ("decodepool%u", n);
+    g_thread_unref (g_thread_new (name, worker_thread, GUINT_TO_POINTER (n)));
+    g_free (name);
+  }
+  return p;
+}
+
+DecodePoolStream *
+decode_pool_stream_new (DecodePoolFunc func, gpointer user_data)
+{
+  static GOnce once = G_ONCE_INIT;
+  DecodePoolStream *stream;
+
+  g_once (&once, create_pool, NULL);
+
+  stream = g_new0 (DecodePoolStream, 1);
+  stream->func = func;
+  stream->user_data = user_data;
+  stream->home = g_atomic_int_add (&pool->next_home, 1) % pool->n_workers;
+  g_mutex_init (&stream->lock);
+  g_cond_init (&stream->idle);
+  g_queue_init (&stream->jobs);
+  return stream;
+}
+
+void
+decode_pool_stream_push (DecodePoolStream * stream, gpointer job)
+{
+  gboolean schedule;
+
+  g_mutex_lock (&stream->lock);
+  g_queue_push_tail (&stream->jobs, job);
+  stream->pending++;
+  schedule = !stream->scheduled;
+  stream->scheduled = TRUE;
+  g_mutex_unlock (&stream->lock);
+
+  if (schedule)
+    enqueue_stream (stream->home, stream);
+}
+
+void
+decode_pool_stream_flush (DecodePoolStream * stream)
+{
+  g_mutex_lock (&stream->lock);
+  while (stream->pending > 0)
+    g_cond_wait (&stream->idle, &stream->lock);
+  g_mutex_unlock (&stream->lock);
+}
+
+void
+decode_pool_stream_free (DecodePoolStream * stream)
+{
+  decode_pool_stream_flush (stream);
+  g_mutex_clear (&stream->lock);
+  g_cond_clear (&stream->idle);
+  g_free (stream);
+}
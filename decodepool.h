@@ -0,0 +1,50 @@
+/* GStreamer
+ * Copyright (C) 2016 William Manley <will@williammanley.net>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef _DECODEPOOL_H_
+#define _DECODEPOOL_H_
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Process-wide work-stealing pool with one worker per CPU.
+ *
+ * Each user (e.g. a timeoverlayparse instance) creates a DecodePoolStream
+ * and pushes jobs to it.  Jobs of one stream run one at a time in the order
+ * they were pushed; jobs of different streams run in parallel.  A stream
+ * with pending jobs sits on the deque of one worker, idle workers steal
+ * streams from the back of other workers' deques. */
+typedef struct _DecodePoolStream DecodePoolStream;
+
+typedef void (*DecodePoolFunc) (gpointer job, gpointer user_data);
+
+DecodePoolStream *decode_pool_stream_new (DecodePoolFunc func,
+    gpointer user_data);
+void decode_pool_stream_push (DecodePoolStream * stream, gpointer job);
+
+/* Blocks until all jobs pushed so far have run */
+void decode_pool_stream_flush (DecodePoolStream * stream);
+
+/* Flushes and frees the stream */
+void decode_pool_stream_free (DecodePoolStream * stream);
+
+G_END_DECLS
+
+#endif
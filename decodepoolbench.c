@@ -0,0 +1,255 @@
+/* GStreamer
+ *
+ * Copyright (C) 2016 William Manley <will@williammanley.net>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* Times timeoverlayparse's three decode modes without GStreamer, so that
+ * the scheduling can be compared on any machine.  Each stream has a thread
+ * standing in for its streaming thread: it renders a frame (in place of
+ * videotestsrc ! timestampoverlay) and then decodes it in blocks mode the
+ * way the element does, inline, on a thread of the stream's own or on the
+ * shared decodepool, dropping frames beyond max-queued.  Prints the
+ * processing time percentiles (frame ready to decode finished) and the
+ * throughput over all streams. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+
+#include "decodepool.h"
+#include "gsttimeoverlaycodec.h"
+#include "latencystats.h"
+
+#define WIDTH 1280
+#define HEIGHT 720
+#define PXSIZE 4
+/* Frames each stream cycles through, like a capture device's buffer pool */
+#define RING 4
+
+static gchar *mode = NULL;
+static gint streams = 8;
+static gint frames = 3000;
+static gint fps = 0;
+static gint max_queued = 2;
+
+static GOptionEntry entries[] = {
+  { "decode-mode", 'm', 0, G_OPTION_ARG_STRING, &mode,
+    "inline, async or pool (default inline)", "MODE" },
+  { "streams", 'n', 0, G_OPTION_ARG_INT, &streams,
+    "Number of streams (default 8)", "N" },
+  { "frames", 'f', 0, G_OPTION_ARG_INT, &frames,
+    "Frames per stream (default 3000)", "N" },
+  { "fps", 0, 0, G_OPTION_ARG_INT, &fps,
+    "Frames per second per stream, 0 for as fast as possible (default 0)",
+    "N" },
+  { "max-queued", 0, 0, G_OPTION_ARG_INT, &max_queued,
+    "Frames waiting to be decoded before more are dropped (default 2)", "N" },
+  { NULL }
+};
+
+typedef enum {
+  MODE_INLINE,
+  MODE_ASYNC,
+  MODE_POOL
+} DecodeMode;
+
+typedef struct {
+  DecodeMode mode;
+  guint8 *frames[RING];
+  TimeOverlayGatherTable table;
+  GThreadPool *async_pool;
+  DecodePoolStream *pool_stream;
+  gint queued;
+  guint64 dropped;
+
+  GMutex stats_lock;
+  LatencyHistogram *processing;
+  guint64 checksum;
+} Stream;
+
+typedef struct {
+  guint8 *frame;
+  gint64 ready;
+} Job;
+
+static void
+decode (Stream * stream, const guint8 * frame, gint64 ready)
+{
+  TimeOverlayRegion region;
+  guint64 clocks[TIMEOVERLAY_BLOCKS_CLOCKS];
+
+  timeoverlay_code_region (GST_TIMEOVERLAY_MODE_BLOCKS, WIDTH, HEIGHT,
+      &region);
+  if (!timeoverlay_gather_table_matches (&stream->table, region.width,
+          region.height, WIDTH * PXSIZE, PXSIZE))
+    timeoverlay_gather_table_init_blocks (&stream->table, region.width,
+        region.height, WIDTH * PXSIZE, PXSIZE, 0x80, 0);
+  timeoverlay_gather_words (&stream->table, frame +
+      region.y * WIDTH * PXSIZE + region.x * PXSIZE, clocks);
+
+  g_mutex_lock (&stream->stats_lock);
+  if (!stream->processing)
+    stream->processing = latency_histogram_new ();
+  latency_histogram_record (stream->processing,
+      (g_get_monotonic_time () - ready) * 1000);
+  stream->checksum += clocks[0];
+  g_mutex_unlock (&stream->stats_lock);
+}
+
+static void
+decode_job (gpointer data, gpointer user_data)
+{
+  Job *job = data;
+  Stream *stream = user_data;
+
+  decode (stream, job->frame, job->ready);
+  g_slice_free (Job, job);
+  g_atomic_int_add (&stream->queued, -1);
+}
+
+static gpointer
+stream_thread (gpointer data)
+{
+  Stream *stream = data;
+  gint64 start = g_get_monotonic_time (), due, ready;
+  guint8 *frame;
+  Job *job;
+  gint n;
+
+  for (n = 0; n < frames; n++) {
+    if (fps > 0) {
+      due = start + (gint64) n * G_USEC_PER_SEC / fps;
+      if (due > g_get_monotonic_time ())
+        g_usleep (due - g_get_monotonic_time ());
+    }
+    frame = stream->frames[n % RING];
+    memset (frame, n & 0xff, WIDTH * HEIGHT * PXSIZE);
+    ready = g_get_monotonic_time ();
+
+    if (stream->mode == MODE_INLINE) {
+      decode (stream, frame, ready);
+      continue;
+    }
+    if (g_atomic_int_get (&stream->queued) >= max_queued) {
+      stream->dropped++;
+      continue;
+    }
+    job = g_slice_new (Job);
+    job->frame = frame;
+    job->ready = ready;
+    g_atomic_int_inc (&stream->queued);
+    if (stream->mode == MODE_ASYNC)
+      g_thread_pool_push (stream->async_pool, job, NULL);
+    else
+      decode_pool_stream_push (stream->pool_stream, job);
+  }
+  return NULL;
+}
+
+int
+main (int argc, char *argv[])
+{
+  GOptionContext *ctx;
+  GError *err = NULL;
+  DecodeMode decode_mode;
+  Stream *s;
+  GThread **threads;
+  LatencyHistogram *processing;
+  guint64 decoded = 0, dropped = 0;
+  gint64 start, elapsed;
+  gint n, r;
+
+  ctx = g_option_context_new (NULL);
+  g_option_context_add_main_entries (ctx, entries, NULL);
+  if (!g_option_context_parse (ctx, &argc, &argv, &err)) {
+    fprintf (stderr, "%s\n", err->message);
+    return 1;
+  }
+  g_option_context_free (ctx);
+
+  if (!mode || g_str_equal (mode, "inline")) {
+    decode_mode = MODE_INLINE;
+  } else if (g_str_equal (mode, "async")) {
+    decode_mode = MODE_ASYNC;
+  } else if (g_str_equal (mode, "pool")) {
+    decode_mode = MODE_POOL;
+  } else {
+    fprintf (stderr, "Unknown decode mode %s\n", mode);
+    return 1;
+  }
+  if (streams < 1 || frames < 1 || max_queued < 1) {
+    fprintf (stderr, "--streams, --frames and --max-queued must be "
+        "positive\n");
+    return 1;
+  }
+
+  s = g_new0 (Stream, streams);
+  threads = g_new0 (GThread *, streams);
+  for (n = 0; n < streams; n++) {
+    s[n].mode = decode_mode;
+    for (r = 0; r < RING; r++)
+      s[n].frames[r] = g_malloc0 (WIDTH * HEIGHT * PXSIZE);
+    g_mutex_init (&s[n].stats_lock);
+    if (decode_mode == MODE_ASYNC)
+      s[n].async_pool = g_thread_pool_new (decode_job, &s[n], 1, FALSE,
+          NULL);
+    else if (decode_mode == MODE_POOL)
+      s[n].pool_stream = decode_pool_stream_new (decode_job, &s[n]);
+  }
+
+  start = g_get_monotonic_time ();
+  for (n = 0; n < streams; n++)
+    threads[n] = g_thread_new ("stream", stream_thread, &s[n]);
+  for (n = 0; n < streams; n++) {
+    g_thread_join (threads[n]);
+    if (s[n].async_pool)
+      g_thread_pool_free (s[n].async_pool, FALSE, TRUE);
+    if (s[n].pool_stream)
+      decode_pool_stream_free (s[n].pool_stream);
+  }
+  elapsed = g_get_monotonic_time () - start;
+
+  processing = latency_histogram_new ();
+  for (n = 0; n < streams; n++) {
+    if (s[n].processing) {
+      latency_histogram_merge (processing, s[n].processing);
+      latency_histogram_free (s[n].processing);
+    }
+    dropped += s[n].dropped;
+    for (r = 0; r < RING; r++)
+      g_free (s[n].frames[r]);
+    g_mutex_clear (&s[n].stats_lock);
+  }
+  decoded = processing->count;
+
+  printf ("%s, %d streams on %u CPUs: %.0f frames/s decoded, %.2f%% dropped, "
+      "processing p50 %.3f ms, p99 %.3f ms, p99.9 %.3f ms, max %.3f ms\n",
+      mode ? mode : "inline", streams, g_get_num_processors (),
+      decoded * 1e6 / MAX (elapsed, 1),
+      100. * dropped / MAX (decoded + dropped, 1),
+      latency_histogram_percentile (processing, 50.) / 1e6,
+      latency_histogram_percentile (processing, 99.) / 1e6,
+      latency_histogram_percentile (processing, 99.9) / 1e6,
+      decoded ? processing->max / 1e6 : 0.);
+
+  latency_histogram_free (processing);
+  g_free (threads);
+  g_free (s);
+  return 0;
+}
@@ -53,6 +53,8 @@
 #include <time.h>
 #include <sys/stat.h>
 
+#include "gsttimeoverlaycodec.h"
+
 #define DEBUG_OUTPUT
 
 /* Size of image that can be processed
@@ -60,18 +62,14 @@
 const unsigned int WIDTH = 640;
 const unsigned int HEIGHT = 480;
 
-/* Size of the "bit" in terms of pixels (width and height)
- * Assumes square block.
- */
-const unsigned int PIXELS_PER_BIT_X = 8;
-const unsigned int PIXELS_PER_BIT_Y = 8;
-
 /* Number of bytes per pixel. A 24-bit RGB value takes 3 bytes
  */
 const unsigned int PIXEL_STRIDE = 3;
 
-const unsigned int number_of_clocks = 6;
-const unsigned int number_of_bits_per_clock = 64;
+/* The screen grabs are inverted compared to the video, a dark block is a 1
+ */
+const __uint8_t SAMPLE_THRESHOLD = 0x80;
+const __uint8_t SAMPLE_POLARITY = 1;
 
 /* The clocks that have been encoded in the video frame
  */
@@ -89,7 +87,8 @@ typedef struct
  */
 static void help_usage()
 {
-  printf("Usage: timeoverlay-parse <.ppm file>\n");
+  printf("Usage: timeoverlay-parse [-b <iterations>] <.ppm file>\n");
+  printf("  -b  Time decoding the image <iterations> times\n");
   exit(0);
 }
 
@@ -268,37 +267,24 @@ static void threshold_image(__uint8_t *image, int width, int height)
   }
 }
 
-/* Read a timestamp from the screen grab.
- * There can be a number of digitally encoded clocks, so the offset to each one
- * is specified in the lineoffset. The image buffer is specified in buf.
- * stride is the width of the image in pixels and pxsize is the number of bytes
- * per pixel, where a 24bit RGB value will be have a pxsize of 3.
- * The decoded value is returned.
+/* Work out where each bit of the clocks is in the screen grab.
+ * The encoded data is held as 64bit binary. Each bit is an 8x8 block. There
+ * can be up to 6 different clocks encoded in the image. The whole lot is placed
+ * in the center of the video feed to ease in finding the data. The table holds
+ * the byte offset of the middle of each block, so it only has to be worked out
+ * once for a given image size.
  */
-static __uint64_t read_timestamp(int lineoffset, __uint8_t *buf, size_t stride, int pxsize)
+static void build_gather_table(int width, int height, TimeOverlayGatherTable* table)
 {
-  __uint64_t timestamp = 0;
-
-  buf += (lineoffset * PIXELS_PER_BIT_Y + (PIXELS_PER_BIT_Y / 2)) * stride; // Get vertical center of the 8x8 pixel block
-
-  #ifdef DEBUG_OUTPUT
-    printf("Clock=");
-  #endif
-
-  for (int bit = 0; bit < 64; bit++)
+  if (!timeoverlay_gather_table_init_blocks(table, width, height,
+      width * PIXEL_STRIDE, PIXEL_STRIDE, SAMPLE_THRESHOLD, SAMPLE_POLARITY))
   {
-    __uint8_t color = buf[bit * pxsize * PIXELS_PER_BIT_X + (PIXELS_PER_BIT_X / 2)];  // Bit offset + horiz center of the 8x8 pixel block
-    color = (color & 0x80) ? 0x00 : 0xFF;;
-    #ifdef DEBUG_OUTPUT
-      printf("%.02x ", (unsigned int)color);
-    #endif
-    timestamp |= (color) ? (__uint64_t) 1 << (63 - bit) : 0;
+    printf("Image too small to hold the clocks\n");
+    exit(1);
   }
   #ifdef DEBUG_OUTPUT
-    printf("\n");
+    printf("First clock bit at offset (in bytes)=%u\n", table->offsets[0]);
   #endif
-
-  return timestamp;
 }
 
 static void dump_image(__uint8_t *buf, int width, int height)
@@ -350,32 +336,77 @@ static void find_first_non_black(__uint8_t *buf)
 }
 #endif
 
-/* Decode the timestamp from the image
- * Overall image size is specified in the width and height and the pixel data
- * is specified in image. The decoded clocks is returned in a structure since
- * there are up to 6 different clocks.
- * The encoded data is held as 64bit binary. Each bit is an 8x8 block. There
- * can be up to 6 different clocks encoded in the iamge. The whole lot is placed
- * in the center of the video feed to ease in finding the data.
+/* Decode the timestamps from the image
+ * The pixel data is specified in image and the location of each bit in table.
+ * The decoded clocks is returned in a structure since there are up to 6
+ * different clocks.
  */
-static void decode_timestamps(int width, int height, __uint8_t* image, encoded_clocks_t* clocks)
+static void decode_timestamps(const TimeOverlayGatherTable* table, __uint8_t* image, encoded_clocks_t* clocks)
 {
-  const unsigned int line_stride = width * PIXEL_STRIDE;
+  __uint64_t words[TIMEOVERLAY_BLOCKS_CLOCKS];
+
+  timeoverlay_gather_words(table, image, words);
+  clocks->buffer_time = words[0];
+  clocks->stream_time = words[1];
+  clocks->running_time = words[2];
+  clocks->clock_time = words[3];
+  clocks->render_time = words[4];
+  clocks->render_realtime = words[5];
+}
 
+static void print_timestamps(const encoded_clocks_t* clocks)
+{
+  printf("Read timestamps:\n" \
+         "buffer_time = 0x%lx %s" \
+         "stream_time = 0x%lx %s" \
+         "running_time = 0x%lx %s" \
+         "clock_time = 0x%lx %s" \
+         "render_time = 0x%lx %s" \
+         "render_realtime = 0x%lx %s",
+      clocks->buffer_time, ctime((const time_t *)&clocks->buffer_time),
+      clocks->stream_time, ctime((const time_t *)&clocks->stream_time),
+      clocks->running_time, ctime((const time_t *)&clocks->running_time),
+      clocks->clock_time, ctime((const time_t *)&clocks->clock_time),
+      clocks->render_time, ctime((const time_t *)&clocks->render_time),
+      clocks->render_realtime, ctime((const time_t *)&clocks->render_realtime));
+}
+
+/* The decoder as it was before the gather table, for comparison in the
+ * benchmark: works out the offset of every bit from the image size on each
+ * frame.  Each bit is the middle of an 8x8 block, the 6 clocks of 64 bits are
+ * in the centre of the image.
+ */
+#define PIXELS_PER_BIT_X 8
+#define PIXELS_PER_BIT_Y 8
+
+static __uint64_t read_timestamp(int lineoffset, __uint8_t *buf, size_t stride, int pxsize)
+{
+  __uint64_t timestamp = 0;
+
+  buf += (lineoffset * PIXELS_PER_BIT_Y + (PIXELS_PER_BIT_Y / 2)) * stride; // Get vertical center of the 8x8 pixel block
+
+  for (int bit = 0; bit < 64; bit++)
+  {
+    __uint8_t color = buf[bit * pxsize * PIXELS_PER_BIT_X + (PIXELS_PER_BIT_X / 2)];  // Bit offset + horiz center of the 8x8 pixel block
+    color = (color & 0x80) ? 0x00 : 0xFF;
+    timestamp |= (color) ? (__uint64_t) 1 << (63 - bit) : 0;
+  }
+  return timestamp;
+}
+
+static void decode_timestamps_per_frame(int width, int height, __uint8_t* image, encoded_clocks_t* clocks)
+{
+  const unsigned int line_stride = width * PIXEL_STRIDE;
   __uint8_t *imgdata = image;
 
-  /* Find row that the clocks start on (in bytes) */
-  int vert_offset = ((height - (number_of_clocks * PIXELS_PER_BIT_Y)) * line_stride) / 2; // 6 clocks
-  printf("Vertical offset (in bytes)=%d\n", vert_offset);
+  int vert_offset = ((height - (TIMEOVERLAY_BLOCKS_CLOCKS * PIXELS_PER_BIT_Y)) * line_stride) / 2;
   if (vert_offset < 0)
   {
     vert_offset = 0;
   }
   imgdata += vert_offset;
 
-  /* Find column that the clocks start on (in bytes) */
-  int horiz_offset = ((width - (number_of_bits_per_clock * PIXELS_PER_BIT_X)) * PIXEL_STRIDE) / 2;  // 64 bits
-  printf("Horizontal offset (in bytes)=%d\n", horiz_offset);
+  int horiz_offset = ((width - (64 * PIXELS_PER_BIT_X)) * PIXEL_STRIDE) / 2;
   if (horiz_offset < 0)
   {
     horiz_offset = 0;
@@ -388,20 +419,52 @@ static void decode_timestamps(int width, int height, __uint8_t* image, encoded_c
   clocks->clock_time = read_timestamp(3, imgdata, line_stride, PIXEL_STRIDE);
   clocks->render_time = read_timestamp(4, imgdata, line_stride, PIXEL_STRIDE);
   clocks->render_realtime = read_timestamp(5, imgdata, line_stride, PIXEL_STRIDE);
+}
 
-  printf("Read timestamps:\n" \
-         "buffer_time = 0x%lx %s" \
-         "stream_time = 0x%lx %s" \
-         "running_time = 0x%lx %s" \
-         "clock_time = 0x%lx %s" \
-         "render_time = 0x%lx %s" \
-         "render_realtime = 0x%lx %s",
-      clocks->buffer_time, ctime((const time_t *)&clocks->buffer_time),
-      clocks->stream_time, ctime((const time_t *)&clocks->stream_time),
-      clocks->running_time, ctime((const time_t *)&clocks->running_time),
-      clocks->clock_time, ctime((const time_t *)&clocks->clock_time),
-      clocks->render_time, ctime((const time_t *)&clocks->render_time),
-      clocks->render_realtime, ctime((const time_t *)&clocks->render_realtime));
+static double elapsed_ns(const struct timespec* start, const struct timespec* end)
+{
+  return (end->tv_sec - start->tv_sec) * 1e9 + (end->tv_nsec - start->tv_nsec);
+}
+
+/* Time decoding the image over and over, both with the old per-frame offset
+ * loop and with the precomputed table
+ */
+static void benchmark(int width, int height, __uint8_t* image, int iterations)
+{
+  TimeOverlayGatherTable table;
+  encoded_clocks_t clocks, expected;
+  struct timespec start, end;
+  volatile __uint64_t sink = 0;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int n = 0; n < iterations; ++n)
+  {
+    decode_timestamps_per_frame(width, height, image, &clocks);
+    sink += clocks.clock_time;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  printf("Per-frame offset loop: %.1f ns/frame\n",
+      elapsed_ns(&start, &end) / iterations);
+
+  timeoverlay_gather_table_init_blocks(&table, width, height,
+      width * PIXEL_STRIDE, PIXEL_STRIDE, SAMPLE_THRESHOLD, SAMPLE_POLARITY);
+  decode_timestamps_per_frame(width, height, image, &expected);
+  decode_timestamps(&table, image, &clocks);
+  if (memcmp(&clocks, &expected, sizeof(clocks)) != 0)
+  {
+    printf("Warning: the two decoders disagree\n");
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int n = 0; n < iterations; ++n)
+  {
+    decode_timestamps(&table, image, &clocks);
+    sink += clocks.clock_time;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  printf("Precomputed table: %.1f ns/frame\n",
+      elapsed_ns(&start, &end) / iterations);
+  (void)sink;
 }
 
 /* Main
@@ -411,9 +474,17 @@ int main(int argc, char** argv)
   int width;
   int height;
   int depth;
+  int iterations = 0;
   encoded_clocks_t clocks;
+  TimeOverlayGatherTable table;
 
-  if (argc == 1)
+  if (argc >= 3 && strcmp(argv[1], "-b") == 0)
+  {
+    iterations = atoi(argv[2]);
+    argv += 2;
+    argc -= 2;
+  }
+  if (argc == 1 || iterations < 0)
   {
     help_usage();
   }
@@ -438,10 +509,18 @@ int main(int argc, char** argv)
     exit(1);
   }
   __uint8_t *image = load_image(fd, width, height);
+  if (iterations > 0)
+  {
+    benchmark(width, height, image, iterations);
+    free(image);
+    return 0;
+  }
   if (0) threshold_image(image, width, height);
   dump_image(image, width, height);
   // find_first_non_black(image);
-  decode_timestamps(width, height, image, &clocks);
+  build_gather_table(width, height, &table);
+  decode_timestamps(&table, image, &clocks);
+  print_timestamps(&clocks);
   free(image);
 
   time_t current = time(NULL);
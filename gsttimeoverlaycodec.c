@@ -0,0 +1,435 @@
+/* GStreamer
+ * Copyright (C) 2016 William Manley <will@williammanley.net>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "gsttimeoverlaycodec.h"
+
+#include <string.h>
+
+GType
+gst_timeoverlay_mode_get_type (void)
+{
+  static GType type = 0;
+  static const GEnumValue values[] = {
+    {GST_TIMEOVERLAY_MODE_BLOCKS,
+        "64-bit timestamps as 8x8 blocks in the centre of the frame", "blocks"},
+    {GST_TIMEOVERLAY_MODE_VITC,
+        "VITC-style bit stream on the first lines of the frame", "vitc"},
+    {GST_TIMEOVERLAY_MODE_TEMPORAL,
+        "One bit per frame in the brightness of a large patch, for "
+        "thumbnails", "temporal"},
+    {0, NULL, NULL}
+  };
+
+  if (g_once_init_enter (&type)) {
+    GType tmp = g_enum_register_static ("GstTimeOverlayMode", values);
+    g_once_init_leave (&type, tmp);
+  }
+  return type;
+}
+
+gboolean
+timeoverlay_code_region (GstTimeOverlayMode mode, gint width, gint height,
+    TimeOverlayRegion * region)
+{
+  switch (mode) {
+    case GST_TIMEOVERLAY_MODE_VITC:
+      region->width = width;
+      region->height = TIMEOVERLAY_VITC_LINES;
+      break;
+    case GST_TIMEOVERLAY_MODE_TEMPORAL:
+      region->width = (width / 2) & ~1;
+      region->height = (height / 2) & ~1;
+      break;
+    case GST_TIMEOVERLAY_MODE_BLOCKS:
+    default:
+      region->width = 64 * TIMEOVERLAY_BLOCK_SIZE;
+      region->height = TIMEOVERLAY_BLOCKS_CLOCKS * TIMEOVERLAY_BLOCK_SIZE;
+      break;
+  }
+
+  if (mode == GST_TIMEOVERLAY_MODE_BLOCKS) {
+    region->x = ((width - region->width) / 2) & ~1;
+    region->y = ((height - region->height) / 2) & ~1;
+  } else {
+    region->x = 0;
+    region->y = 0;
+  }
+
+  if (mode == GST_TIMEOVERLAY_MODE_VITC && width < 2 * TIMEOVERLAY_VITC_BITS)
+    return FALSE;
+  return region->width > 0 && region->height > 0 &&
+      region->width <= width && region->height <= height;
+}
+
+/* CRC-8, polynomial x^8 + x^2 + x + 1 */
+guint8
+timeoverlay_crc8 (const guint8 * data, gsize len)
+{
+  guint8 crc = 0;
+  int bit;
+
+  while (len--) {
+    crc ^= *data++;
+    for (bit = 0; bit < 8; bit++)
+      crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1;
+  }
+  return crc;
+}
+
+static void
+gather_table_set_layout (TimeOverlayGatherTable * table, gint width,
+    gint height, gint stride, gint pxsize, guint n_samples, guint8 threshold,
+    guint8 polarity)
+{
+  table->width = width;
+  table->height = height;
+  table->stride = stride;
+  table->pxsize = pxsize;
+  table->n_samples = n_samples;
+  memset (table->thresholds, threshold, n_samples);
+  memset (table->polarity, polarity, n_samples);
+}
+
+gboolean
+timeoverlay_gather_table_init_blocks (TimeOverlayGatherTable * table,
+    gint width, gint height, gint stride, gint pxsize, guint8 threshold,
+    guint8 polarity)
+{
+  TimeOverlayRegion region;
+  guint32 base, *offset = table->offsets;
+  int clock, bit;
+
+  table->n_samples = 0;
+  if (!timeoverlay_code_region (GST_TIMEOVERLAY_MODE_BLOCKS, width, height,
+          &region))
+    return FALSE;
+
+  gather_table_set_layout (table, width, height, stride, pxsize,
+      TIMEOVERLAY_BLOCKS_CLOCKS * 64, threshold, polarity);
+
+  /* The middle line of each row of blocks and a few bytes into each block */
+  base = region.y * stride + region.x * pxsize;
+  for (clock = 0; clock < TIMEOVERLAY_BLOCKS_CLOCKS; clock++)
+    for (bit = 0; bit < 64; bit++)
+      *offset++ = base + (clock * TIMEOVERLAY_BLOCK_SIZE +
+          TIMEOVERLAY_BLOCK_SIZE / 2) * stride +
+          bit * pxsize * TIMEOVERLAY_BLOCK_SIZE + TIMEOVERLAY_BLOCK_SIZE / 2;
+  return TRUE;
+}
+
+gboolean
+timeoverlay_gather_table_init_vitc (TimeOverlayGatherTable * table,
+    gint width, gint height, gint stride, gint pxsize, guint8 threshold,
+    guint8 polarity)
+{
+  int bit;
+
+  table->n_samples = 0;
+  if (width < 2 * TIMEOVERLAY_VITC_BITS || height < TIMEOVERLAY_VITC_LINES)
+    return FALSE;
+
+  gather_table_set_layout (table, width, height, stride, pxsize,
+      TIMEOVERLAY_VITC_BITS, threshold, polarity);
+  for (bit = 0; bit < TIMEOVERLAY_VITC_BITS; bit++)
+    table->offsets[bit] = (2 * bit + 1) * width / (2 * TIMEOVERLAY_VITC_BITS)
+        * pxsize;
+  return TRUE;
+}
+
+gboolean
+timeoverlay_gather_table_matches (const TimeOverlayGatherTable * table,
+    gint width, gint height, gint stride, gint pxsize)
+{
+  return table->n_samples > 0 && table->width == width &&
+      table->height == height && table->stride == stride &&
+      table->pxsize == pxsize;
+}
+
+void
+timeoverlay_gather_bits (const TimeOverlayGatherTable * table,
+    const guint8 * data, guint8 * bits)
+{
+  guint n;
+
+  for (n = 0; n < table->n_samples; n++)
+    bits[n] = (data[table->offsets[n]] >= table->thresholds[n]) ^
+        table->polarity[n];
+}
+
+void
+timeoverlay_gather_words (const TimeOverlayGatherTable * table,
+    const guint8 * data, guint64 * words)
+{
+  guint64 word;
+  guint n, bit;
+
+  for (n = 0; n < table->n_samples; n += 64) {
+    word = 0;
+    for (bit = n; bit < n + 64; bit++)
+      word = (word << 1) | ((data[table->offsets[bit]] >=
+              table->thresholds[bit]) ^ table->polarity[bit]);
+    *words++ = word;
+  }
+}
+
+void
+timeoverlay_vitc_pack (guint64 timestamp, guint32 sequence,
+    guint8 bits[TIMEOVERLAY_VITC_BITS])
+{
+  guint8 bytes[TIMEOVERLAY_VITC_BYTES];
+  int n, bit;
+
+  for (n = 0; n < 8; n++)
+    bytes[n] = timestamp >> (56 - n * 8);
+  for (n = 0; n < 4; n++)
+    bytes[8 + n] = sequence >> (24 - n * 8);
+  bytes[TIMEOVERLAY_VITC_BYTES - 1] =
+      timeoverlay_crc8 (bytes, TIMEOVERLAY_VITC_BYTES - 1);
+
+  for (n = 0; n < TIMEOVERLAY_VITC_BYTES; n++) {
+    *bits++ = 1;
+    *bits++ = 0;
+    for (bit = 0; bit < 8; bit++)
+      *bits++ = (bytes[n] >> (7 - bit)) & 1;
+  }
+}
+
+gboolean
+timeoverlay_vitc_unpack (const guint8 bits[TIMEOVERLAY_VITC_BITS],
+    guint64 * timestamp, guint32 * sequence)
+{
+  guint8 bytes[TIMEOVERLAY_VITC_BYTES];
+  int n, bit;
+
+  for (n = 0; n < TIMEOVERLAY_VITC_BYTES; n++) {
+    if (bits[0] != 1 || bits[1] != 0)
+      return FALSE;
+    bits += 2;
+    bytes[n] = 0;
+    for (bit = 0; bit < 8; bit++)
+      bytes[n] = (bytes[n] << 1) | *bits++;
+  }
+
+  if (timeoverlay_crc8 (bytes, TIMEOVERLAY_VITC_BYTES - 1) !=
+      bytes[TIMEOVERLAY_VITC_BYTES - 1])
+    return FALSE;
+
+  *timestamp = 0;
+  for (n = 0; n < 8; n++)
+    *timestamp = (*timestamp << 8) | bytes[n];
+  *sequence = 0;
+  for (n = 0; n < 4; n++)
+    *sequence = (*sequence << 8) | bytes[8 + n];
+  return TRUE;
+}
+
+void
+timeoverlay_temporal_pack (guint64 timestamp, guint32 sequence,
+    guint8 bits[TIMEOVERLAY_TEMPORAL_BITS])
+{
+  guint8 bytes[TIMEOVERLAY_TEMPORAL_BYTES];
+  int n, bit;
+
+  bytes[0] = TIMEOVERLAY_TEMPORAL_SYNC >> 8;
+  bytes[1] = TIMEOVERLAY_TEMPORAL_SYNC & 0xff;
+  for (n = 0; n < 4; n++)
+    bytes[2 + n] = sequence >> (24 - n * 8);
+  for (n = 0; n < 8; n++)
+    bytes[6 + n] = timestamp >> (56 - n * 8);
+  bytes[TIMEOVERLAY_TEMPORAL_BYTES - 1] =
+      timeoverlay_crc8 (bytes + 2, TIMEOVERLAY_TEMPORAL_BYTES - 3);
+
+  for (n = 0; n < TIMEOVERLAY_TEMPORAL_BYTES; n++)
+    for (bit = 0; bit < 8; bit++)
+      *bits++ = (bytes[n] >> (7 - bit)) & 1;
+}
+
+void
+timeoverlay_temporal_decoder_reset (TimeOverlayTemporalDecoder * dec)
+{
+  dec->n_bits = 0;
+  dec->last_phase = -1;
+  dec->locked = FALSE;
+  dec->period = 0;
+}
+
+/* Tries to read a word out of the last TIMEOVERLAY_TEMPORAL_BITS bits.  The
+ * word must end on this frame, have the right sync and CRC and start on a
+ * word boundary. */
+static gboolean
+temporal_unpack (const TimeOverlayTemporalDecoder * dec, guint64 * timestamp,
+    guint32 * sequence)
+{
+  guint8 bytes[TIMEOVERLAY_TEMPORAL_BYTES];
+  int n, bit;
+
+  for (n = 0; n < TIMEOVERLAY_TEMPORAL_BYTES; n++) {
+    bytes[n] = 0;
+    for (bit = 0; bit < 8; bit++)
+      bytes[n] = (bytes[n] << 1) | dec->bits[(dec->n_bits + n * 8 + bit) %
+          TIMEOVERLAY_TEMPORAL_BITS];
+  }
+
+  if (((bytes[0] << 8) | bytes[1]) != TIMEOVERLAY_TEMPORAL_SYNC ||
+      timeoverlay_crc8 (bytes + 2, TIMEOVERLAY_TEMPORAL_BYTES - 3) !=
+      bytes[TIMEOVERLAY_TEMPORAL_BYTES - 1])
+    return FALSE;
+
+  *sequence = 0;
+  for (n = 0; n < 4; n++)
+    *sequence = (*sequence << 8) | bytes[2 + n];
+  *timestamp = 0;
+  for (n = 0; n < 8; n++)
+    *timestamp = (*timestamp << 8) | bytes[6 + n];
+  return *sequence % TIMEOVERLAY_TEMPORAL_BITS == 0;
+}
+
+gboolean
+timeoverlay_temporal_decoder_push (TimeOverlayTemporalDecoder * dec,
+    guint bit, guint phase, guint64 nominal_period, guint64 * timestamp,
+    guint32 * sequence)
+{
+  guint advance = 1;
+  guint32 word_sequence;
+  guint64 word_timestamp;
+
+  if (dec->last_phase >= 0)
+    advance = (phase - dec->last_phase) % TIMEOVERLAY_TEMPORAL_PHASES;
+  dec->last_phase = phase;
+
+  if (advance == 0) {
+    /* The same frame again, it carries no new bit */
+  } else {
+    /* Bits are lost with dropped frames, so start collecting a new word.
+     * Counting phases still tells us which frame this is. */
+    if (advance > 1)
+      dec->n_bits = 0;
+    dec->sequence += advance;
+    dec->bits[dec->n_bits++ % TIMEOVERLAY_TEMPORAL_BITS] = bit;
+
+    /* Every position is tried, not just where we expect a word to end, so
+     * that we resynchronise if more frames were dropped than the phase can
+     * count */
+    if (dec->n_bits >= TIMEOVERLAY_TEMPORAL_BITS &&
+        temporal_unpack (dec, &word_timestamp, &word_sequence)) {
+      if (dec->locked && word_sequence > dec->anchor_sequence)
+        dec->period = (word_timestamp - dec->anchor_timestamp) /
+            (word_sequence - dec->anchor_sequence);
+      dec->locked = TRUE;
+      dec->sequence = word_sequence + TIMEOVERLAY_TEMPORAL_BITS - 1;
+      dec->anchor_sequence = word_sequence;
+      dec->anchor_timestamp = word_timestamp;
+    }
+    /* Keep n_bits from overflowing while staying >= the word length */
+    if (dec->n_bits >= 2 * TIMEOVERLAY_TEMPORAL_BITS)
+      dec->n_bits -= TIMEOVERLAY_TEMPORAL_BITS;
+  }
+
+  if (!dec->locked || (dec->period == 0 && nominal_period == 0))
+    return FALSE;
+
+  *sequence = dec->sequence;
+  *timestamp = dec->anchor_timestamp +
+      (guint64) (guint32) (dec->sequence - dec->anchor_sequence) *
+      (dec->period ? dec->period : nominal_period);
+  return TRUE;
+}
+
+void
+timeoverlay_period_estimator_reset (TimeOverlayPeriodEstimator * est)
+{
+  est->have_last = FALSE;
+  est->period = 0;
+  est->candidate = 0;
+}
+
+/* TRUE if step is within 1% of a whole number of periods */
+static gboolean
+is_multiple (guint64 step, guint64 period)
+{
+  guint64 rem = step % period;
+
+  return step >= period - period / 100 &&
+      MIN (rem, period - rem) <= period / 100;
+}
+
+guint64
+timeoverlay_period_estimator_push (TimeOverlayPeriodEstimator * est,
+    gint64 sequence, guint64 timestamp)
+{
+  gint64 frames = 1;
+  guint64 step;
+
+  if (!est->have_last || timestamp <= est->last_timestamp ||
+      (sequence >= 0 && sequence <= est->last_sequence)) {
+    /* A repeated frame or a restart, nothing to measure */
+    if (!est->have_last || timestamp != est->last_timestamp) {
+      est->last_sequence = sequence;
+      est->last_timestamp = timestamp;
+      est->have_last = TRUE;
+    }
+    return est->period;
+  }
+  if (sequence >= 0)
+    frames = sequence - est->last_sequence;
+  step = (timestamp - est->last_timestamp) / frames;
+  est->last_sequence = sequence;
+  est->last_timestamp = timestamp;
+
+  if (sequence >= 0) {
+    /* render_realtime jitters, so average, but don't let a misread code or
+     * a server restart pull the estimate away */
+    if (est->period && step > est->period - est->period / 4 &&
+        step < est->period + est->period / 4) {
+      est->period = (est->period * 7 + step) / 8;
+      return est->period;
+    }
+  } else if (est->period && is_multiple (step, est->period)) {
+    return est->period;
+  }
+
+  /* Doesn't fit the current estimate: it takes two steps that agree to
+   * replace it */
+  if (est->candidate && sequence >= 0 && step > est->candidate -
+      est->candidate / 4 && step < est->candidate + est->candidate / 4) {
+    est->period = (est->candidate + step) / 2;
+    est->candidate = 0;
+  } else if (est->candidate && sequence < 0 &&
+      (is_multiple (step, est->candidate) ||
+          is_multiple (est->candidate, step))) {
+    est->period = MIN (step, est->candidate);
+    est->candidate = 0;
+  } else {
+    est->candidate = step;
+  }
+  return est->period;
+}
+
+void
+timeoverlay_decoder_reset (TimeOverlayDecoder * decoder)
+{
+  decoder->blocks.n_samples = 0;
+  decoder->vitc.n_samples = 0;
+  timeoverlay_temporal_decoder_reset (&decoder->temporal);
+  timeoverlay_period_estimator_reset (&decoder->period);
+}
@@ -0,0 +1,190 @@
+/* GStreamer
+ * Copyright (C) 2016 William Manley <will@williammanley.net>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef _GST_TIMEOVERLAYCODEC_H_
+#define _GST_TIMEOVERLAYCODEC_H_
+
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+#define GST_TYPE_TIMEOVERLAY_MODE (gst_timeoverlay_mode_get_type())
+
+/* How the timestamps are laid out in the video.  Shared by timestampoverlay
+ * and timeoverlayparse, which must be set to the same mode. */
+typedef enum {
+  GST_TIMEOVERLAY_MODE_BLOCKS,
+  GST_TIMEOVERLAY_MODE_VITC,
+  GST_TIMEOVERLAY_MODE_TEMPORAL
+} GstTimeOverlayMode;
+
+GType gst_timeoverlay_mode_get_type (void);
+
+/* The part of the frame a mode draws over.  Everything the code needs is
+ * inside it and it is drawn over completely, so it can be converted from and
+ * to other formats on its own.  It starts on an even pixel and line, and is
+ * in the same place whatever the format so that a code drawn in one format
+ * can be read in another.  Formats with coarser chroma subsampling or pixel
+ * packing than 2x2 are converted over a larger area, see RoiConverter. */
+typedef struct {
+  gint x;
+  gint y;
+  gint width;
+  gint height;
+} TimeOverlayRegion;
+
+/* Returns FALSE if the frame is too small for the mode */
+gboolean timeoverlay_code_region (GstTimeOverlayMode mode, gint width,
+    gint height, TimeOverlayRegion * region);
+
+/* Blocks mode: TIMEOVERLAY_BLOCKS_CLOCKS 64-bit timestamps, one per row of
+ * 8x8 blocks, centred in the frame.  The region is exactly the blocks. */
+#define TIMEOVERLAY_BLOCKS_CLOCKS 6
+#define TIMEOVERLAY_BLOCK_SIZE 8
+
+/* Where to read each bit of a code from, worked out once per frame layout so
+ * that decoding is a single pass over a table of byte offsets.  A bit is
+ * (data[offset] >= threshold) ^ polarity. */
+#define TIMEOVERLAY_GATHER_MAX_SAMPLES (TIMEOVERLAY_BLOCKS_CLOCKS * 64)
+
+typedef struct {
+  /* The layout the table was built for */
+  gint width;
+  gint height;
+  gint stride;
+  gint pxsize;
+
+  guint n_samples;
+  guint32 offsets[TIMEOVERLAY_GATHER_MAX_SAMPLES];
+  guint8 thresholds[TIMEOVERLAY_GATHER_MAX_SAMPLES];
+  guint8 polarity[TIMEOVERLAY_GATHER_MAX_SAMPLES];
+} TimeOverlayGatherTable;
+
+/* Returns FALSE if the frame is too small for the blocks.  The samples are
+ * in the middle of each block, MSB first. */
+gboolean timeoverlay_gather_table_init_blocks (TimeOverlayGatherTable * table,
+    gint width, gint height, gint stride, gint pxsize, guint8 threshold,
+    guint8 polarity);
+gboolean timeoverlay_gather_table_matches (const TimeOverlayGatherTable * table,
+    gint width, gint height, gint stride, gint pxsize);
+void timeoverlay_gather_bits (const TimeOverlayGatherTable * table,
+    const guint8 * data, guint8 * bits);
+/* For tables of whole 64-bit words, like the blocks table */
+void timeoverlay_gather_words (const TimeOverlayGatherTable * table,
+    const guint8 * data, guint64 * words);
+
+/* VITC-style line code: render_realtime and a frame sequence number written
+ * across the full width of the first TIMEOVERLAY_VITC_LINES lines.  Like
+ * VITC each byte is preceded by a "10" pair of sync bits and the line ends
+ * with a CRC.  Bits are laid out proportionally to the width of the frame so
+ * the line survives horizontal scaling. */
+#define TIMEOVERLAY_VITC_LINES 2
+#define TIMEOVERLAY_VITC_BYTES (8 + 4 + 1)
+#define TIMEOVERLAY_VITC_BITS (TIMEOVERLAY_VITC_BYTES * 10)
+
+guint8 timeoverlay_crc8 (const guint8 * data, gsize len);
+
+void timeoverlay_vitc_pack (guint64 timestamp, guint32 sequence,
+    guint8 bits[TIMEOVERLAY_VITC_BITS]);
+/* The middle of each bit of one line.  Gather from the start of each line
+ * in turn. */
+gboolean timeoverlay_gather_table_init_vitc (TimeOverlayGatherTable * table,
+    gint width, gint height, gint stride, gint pxsize, guint8 threshold,
+    guint8 polarity);
+gboolean timeoverlay_vitc_unpack (const guint8 bits[TIMEOVERLAY_VITC_BITS],
+    guint64 * timestamp, guint32 * sequence);
+
+/* Temporal code for thumbnails too small to carry a spatial code: one bit per
+ * frame in the luminance of a large patch.  The region, the top-left quarter
+ * of the frame, is split in two.  The left half is black or white for the
+ * data bit, the right half is one of 4 grey levels giving the sequence
+ * number mod 4, so that dropped and repeated frames can be told apart from
+ * data.
+ *
+ * The bits form TIMEOVERLAY_TEMPORAL_BITS-bit words starting on frames whose
+ * sequence number is a multiple of TIMEOVERLAY_TEMPORAL_BITS: a sync
+ * pattern, the sequence number and render_realtime of the word's first
+ * frame, and a CRC. */
+#define TIMEOVERLAY_TEMPORAL_SYNC 0xe2d4
+#define TIMEOVERLAY_TEMPORAL_BYTES (2 + 4 + 8 + 1)
+#define TIMEOVERLAY_TEMPORAL_BITS (TIMEOVERLAY_TEMPORAL_BYTES * 8)
+#define TIMEOVERLAY_TEMPORAL_PHASES 4
+
+void timeoverlay_temporal_pack (guint64 timestamp, guint32 sequence,
+    guint8 bits[TIMEOVERLAY_TEMPORAL_BITS]);
+
+/* Reassembles the words from the bit read from each frame.  Once a word has
+ * been decoded every following frame's sequence number is known by counting
+ * phases, and its render_realtime by extrapolating from the start of the
+ * word at the frame period.  The period is measured between words, until
+ * then the nominal period passed to _push is used. */
+typedef struct {
+  guint8 bits[TIMEOVERLAY_TEMPORAL_BITS];
+  guint n_bits;
+  gint last_phase;
+
+  gboolean locked;
+  guint32 sequence;
+  guint32 anchor_sequence;
+  guint64 anchor_timestamp;
+  guint64 period;
+} TimeOverlayTemporalDecoder;
+
+void timeoverlay_temporal_decoder_reset (TimeOverlayTemporalDecoder * dec);
+/* Returns TRUE if the frame's sequence number and render_realtime are known.
+ * nominal_period is 0 if unknown. */
+gboolean timeoverlay_temporal_decoder_push (TimeOverlayTemporalDecoder * dec,
+    guint bit, guint phase, guint64 nominal_period, guint64 * timestamp,
+    guint32 * sequence);
+
+/* Works out the server's frame period from the codes it drew, as it can
+ * differ from the capture framerate.  With a sequence number each step is
+ * divided by the frames it spans and the estimate is a running average.
+ * Without one (blocks mode, where the time pushed is the buffer timestamp)
+ * the steps are multiples of the period, and the period is the smallest
+ * step once a second step that is a multiple of it confirms it. */
+typedef struct {
+  gint64 last_sequence;
+  guint64 last_timestamp;
+  gboolean have_last;
+  guint64 period;
+  guint64 candidate;
+} TimeOverlayPeriodEstimator;
+
+void timeoverlay_period_estimator_reset (TimeOverlayPeriodEstimator * est);
+/* sequence is -1 if the code doesn't carry one.  Returns the period, or 0
+ * while it isn't known. */
+guint64 timeoverlay_period_estimator_push (TimeOverlayPeriodEstimator * est,
+    gint64 sequence, guint64 timestamp);
+
+/* What a decoding thread keeps from frame to frame: gather tables for the
+ * current layout, rebuilt when it changes, the temporal decoder and the
+ * server's frame period */
+typedef struct {
+  TimeOverlayGatherTable blocks;
+  TimeOverlayGatherTable vitc;
+  TimeOverlayTemporalDecoder temporal;
+  TimeOverlayPeriodEstimator period;
+} TimeOverlayDecoder;
+
+void timeoverlay_decoder_reset (TimeOverlayDecoder * decoder);
+
+G_END_DECLS
+
+#endif
@@ -38,6 +38,7 @@
 #include <gst/video/video.h>
 #include <gst/video/gstvideofilter.h>
 #include "gsttimeoverlayparse.h"
+#include "timeoverlayprobes.h"
 
 #include <string.h>
 
@@ -45,24 +46,60 @@ GST_DEBUG_CATEGORY_STATIC (gst_timeoverlayparse_debug_category);
 #define GST_CAT_DEFAULT gst_timeoverlayparse_debug_category
 
 /* prototypes */
+static void gst_timeoverlayparse_set_property (GObject * object,
+    guint property_id, const GValue * value, GParamSpec * pspec);
+static void gst_timeoverlayparse_get_property (GObject * object,
+    guint property_id, GValue * value, GParamSpec * pspec);
+static void gst_timeoverlayparse_finalize (GObject * object);
+static gboolean gst_timeoverlayparse_start (GstBaseTransform * trans);
+static gboolean gst_timeoverlayparse_stop (GstBaseTransform * trans);
 static GstFlowReturn gst_timeoverlayparse_transform_frame_ip (GstVideoFilter * filter,
     GstVideoFrame * frame);
+static void decode_job (gpointer data, gpointer user_data);
 
 enum
 {
-  PROP_0
+  PROP_0,
+  PROP_MODE,
+  PROP_DECODE_MODE,
+  PROP_POST_MESSAGES,
+  PROP_STATS,
+  PROP_ARCHIVE_LOCATION,
+  PROP_EXPORT_LOCATION,
+  PROP_EXPORT_INTERVAL,
+  PROP_MAX_QUEUED
 };
 
-/* pad templates */
+#define DEFAULT_MODE GST_TIMEOVERLAY_MODE_BLOCKS
+#define DEFAULT_DECODE_MODE GST_TIMEOVERLAYPARSE_DECODE_MODE_INLINE
+#define DEFAULT_POST_MESSAGES FALSE
+#define DEFAULT_EXPORT_INTERVAL GST_SECOND
+/* Each queued frame holds on to a buffer, which may be from a capture
+ * device's small fixed-size pool */
+#define DEFAULT_MAX_QUEUED 2
 
-/* FIXME: add/remove formats you can handle */
-#define VIDEO_SRC_CAPS \
-    GST_VIDEO_CAPS_MAKE("{RGB, xRGB, BGR, BGRx}")
-
-/* FIXME: add/remove formats you can handle */
-#define VIDEO_SINK_CAPS \
-    GST_VIDEO_CAPS_MAKE("{RGB, xRGB, BGR, BGRx}")
+GType
+gst_timeoverlayparse_decode_mode_get_type (void)
+{
+  static GType type = 0;
+  static const GEnumValue values[] = {
+    {GST_TIMEOVERLAYPARSE_DECODE_MODE_INLINE,
+        "Decode on the streaming thread", "inline"},
+    {GST_TIMEOVERLAYPARSE_DECODE_MODE_ASYNC,
+        "Decode on a thread of this element's own", "async"},
+    {GST_TIMEOVERLAYPARSE_DECODE_MODE_POOL,
+        "Decode on the work-stealing pool shared by all timeoverlayparse "
+        "instances in the process", "pool"},
+    {0, NULL, NULL}
+  };
 
+  if (g_once_init_enter (&type)) {
+    GType tmp = g_enum_register_static ("GstTimeOverlayParseDecodeMode",
+        values);
+    g_once_init_leave (&type, tmp);
+  }
+  return type;
+}
 
 /* class initialization */
 
@@ -73,28 +110,329 @@ G_DEFINE_TYPE_WITH_CODE (GstTimeOverlayParse, gst_timeoverlayparse, GST_TYPE_VID
 static void
 gst_timeoverlayparse_class_init (GstTimeOverlayParseClass * klass)
 {
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+  GstBaseTransformClass *base_transform_class = GST_BASE_TRANSFORM_CLASS (klass);
   GstVideoFilterClass *video_filter_class = GST_VIDEO_FILTER_CLASS (klass);
+  GstCaps *caps;
 
   /* Setting up pads and setting metadata should be moved to
      base_class_init if you intend to subclass this class. */
+  caps = timeoverlay_video_caps ();
   gst_element_class_add_pad_template (GST_ELEMENT_CLASS(klass),
-      gst_pad_template_new ("src", GST_PAD_SRC, GST_PAD_ALWAYS,
-        gst_caps_from_string (VIDEO_SRC_CAPS)));
+      gst_pad_template_new ("src", GST_PAD_SRC, GST_PAD_ALWAYS, caps));
   gst_element_class_add_pad_template (GST_ELEMENT_CLASS(klass),
-      gst_pad_template_new ("sink", GST_PAD_SINK, GST_PAD_ALWAYS,
-        gst_caps_from_string (VIDEO_SINK_CAPS)));
+      gst_pad_template_new ("sink", GST_PAD_SINK, GST_PAD_ALWAYS, caps));
+  gst_caps_unref (caps);
 
   gst_element_class_set_static_metadata (GST_ELEMENT_CLASS(klass),
       "TimeOverlayParse", "Generic", "Reads the various timestamps from the "
       "video written by timestampoverlay",
       "William Manley <will@williammanley.net>");
 
+  gobject_class->set_property = gst_timeoverlayparse_set_property;
+  gobject_class->get_property = gst_timeoverlayparse_get_property;
+  gobject_class->finalize = gst_timeoverlayparse_finalize;
+  base_transform_class->start = GST_DEBUG_FUNCPTR (gst_timeoverlayparse_start);
+  base_transform_class->stop = GST_DEBUG_FUNCPTR (gst_timeoverlayparse_stop);
   video_filter_class->transform_frame_ip = GST_DEBUG_FUNCPTR (gst_timeoverlayparse_transform_frame_ip);
+
+  g_object_class_install_property (gobject_class, PROP_MODE,
+      g_param_spec_enum ("mode", "Mode",
+          "How the timestamps were drawn onto the video by timestampoverlay",
+          GST_TYPE_TIMEOVERLAY_MODE, DEFAULT_MODE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_DECODE_MODE,
+      g_param_spec_enum ("decode-mode", "Decode mode",
+          "Which thread decodes the frames and updates the statistics",
+          GST_TYPE_TIMEOVERLAYPARSE_DECODE_MODE, DEFAULT_DECODE_MODE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+  g_object_class_install_property (gobject_class, PROP_POST_MESSAGES,
+      g_param_spec_boolean ("post-messages", "Post messages",
+          "Post an element message with the timestamps, latency and "
+          "processing time of every frame decoded", DEFAULT_POST_MESSAGES,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_STATS,
+      g_param_spec_boxed ("stats", "Statistics",
+          "Latency and processing time statistics since the element was "
+          "last started", GST_TYPE_STRUCTURE,
+          G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_ARCHIVE_LOCATION,
+      g_param_spec_string ("archive-location", "Archive location",
+          "File to write the latency of every decoded frame to, see "
+          "archivequery (NULL = don't archive)", NULL,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+  g_object_class_install_property (gobject_class, PROP_EXPORT_LOCATION,
+      g_param_spec_string ("export-location", "Export location",
+          "CSV file to write a per-interval summary of the latency to, for "
+          "plotting (NULL = don't export)", NULL,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+  g_object_class_install_property (gobject_class, PROP_EXPORT_INTERVAL,
+      g_param_spec_uint64 ("export-interval", "Export interval",
+          "Capture time covered by each row of export-location, in "
+          "nanoseconds", 1, G_MAXINT64, DEFAULT_EXPORT_INTERVAL,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+  g_object_class_install_property (gobject_class, PROP_MAX_QUEUED,
+      g_param_spec_uint ("max-queued", "Max queued",
+          "Most frames waiting to be decoded in async and pool decode modes.  "
+          "Any more are dropped and counted as undecoded", 1, G_MAXINT,
+          DEFAULT_MAX_QUEUED, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
 }
 
 static void
 gst_timeoverlayparse_init (GstTimeOverlayParse *timeoverlayparse)
 {
+  timeoverlayparse->mode = DEFAULT_MODE;
+  timeoverlayparse->decode_mode = DEFAULT_DECODE_MODE;
+  timeoverlayparse->post_messages = DEFAULT_POST_MESSAGES;
+  timeoverlayparse->export_interval = DEFAULT_EXPORT_INTERVAL;
+  timeoverlayparse->max_queued = DEFAULT_MAX_QUEUED;
+  g_mutex_init (&timeoverlayparse->stats_lock);
+}
+
+static void
+gst_timeoverlayparse_finalize (GObject * object)
+{
+  GstTimeOverlayParse *timeoverlayparse = GST_TIMEOVERLAYPARSE (object);
+
+  g_mutex_clear (&timeoverlayparse->stats_lock);
+  latency_histogram_free (timeoverlayparse->latency_stats);
+  latency_histogram_free (timeoverlayparse->processing_stats);
+  latency_histogram_free (timeoverlayparse->corrected_stats);
+  g_free (timeoverlayparse->archive_location);
+  g_free (timeoverlayparse->export_location);
+
+  G_OBJECT_CLASS (gst_timeoverlayparse_parent_class)->finalize (object);
+}
+
+static GstStructure *
+get_stats (GstTimeOverlayParse * timeoverlayparse)
+{
+  GstStructure *s = gst_structure_new_empty ("timeoverlayparse-stats");
+
+  g_mutex_lock (&timeoverlayparse->stats_lock);
+  if (timeoverlayparse->latency_stats) {
+    latency_histogram_to_structure (timeoverlayparse->latency_stats, s,
+        "latency");
+    latency_histogram_to_structure (timeoverlayparse->corrected_stats, s,
+        "corrected-latency");
+    latency_histogram_to_structure (timeoverlayparse->processing_stats, s,
+        "processing");
+  }
+  gst_structure_set (s, "dropped", G_TYPE_UINT64, timeoverlayparse->dropped,
+      NULL);
+  g_mutex_unlock (&timeoverlayparse->stats_lock);
+  return s;
+}
+
+static void
+gst_timeoverlayparse_set_property (GObject * object, guint property_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  GstTimeOverlayParse *timeoverlayparse = GST_TIMEOVERLAYPARSE (object);
+
+  switch (property_id) {
+    case PROP_MODE:
+      GST_OBJECT_LOCK (timeoverlayparse);
+      timeoverlayparse->mode = g_value_get_enum (value);
+      GST_OBJECT_UNLOCK (timeoverlayparse);
+      break;
+    case PROP_DECODE_MODE:
+      GST_OBJECT_LOCK (timeoverlayparse);
+      timeoverlayparse->decode_mode = g_value_get_enum (value);
+      GST_OBJECT_UNLOCK (timeoverlayparse);
+      break;
+    case PROP_POST_MESSAGES:
+      g_atomic_int_set (&timeoverlayparse->post_messages,
+          g_value_get_boolean (value));
+      break;
+    case PROP_ARCHIVE_LOCATION:
+      GST_OBJECT_LOCK (timeoverlayparse);
+      g_free (timeoverlayparse->archive_location);
+      timeoverlayparse->archive_location = g_value_dup_string (value);
+      GST_OBJECT_UNLOCK (timeoverlayparse);
+      break;
+    case PROP_EXPORT_LOCATION:
+      GST_OBJECT_LOCK (timeoverlayparse);
+      g_free (timeoverlayparse->export_location);
+      timeoverlayparse->export_location = g_value_dup_string (value);
+      GST_OBJECT_UNLOCK (timeoverlayparse);
+      break;
+    case PROP_EXPORT_INTERVAL:
+      GST_OBJECT_LOCK (timeoverlayparse);
+      timeoverlayparse->export_interval = g_value_get_uint64 (value);
+      GST_OBJECT_UNLOCK (timeoverlayparse);
+      break;
+    case PROP_MAX_QUEUED:
+      GST_OBJECT_LOCK (timeoverlayparse);
+      timeoverlayparse->max_queued = g_value_get_uint (value);
+      GST_OBJECT_UNLOCK (timeoverlayparse);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_timeoverlayparse_get_property (GObject * object, guint property_id,
+    GValue * value, GParamSpec * pspec)
+{
+  GstTimeOverlayParse *timeoverlayparse = GST_TIMEOVERLAYPARSE (object);
+
+  switch (property_id) {
+    case PROP_MODE:
+      GST_OBJECT_LOCK (timeoverlayparse);
+      g_value_set_enum (value, timeoverlayparse->mode);
+      GST_OBJECT_UNLOCK (timeoverlayparse);
+      break;
+    case PROP_DECODE_MODE:
+      GST_OBJECT_LOCK (timeoverlayparse);
+      g_value_set_enum (value, timeoverlayparse->decode_mode);
+      GST_OBJECT_UNLOCK (timeoverlayparse);
+      break;
+    case PROP_POST_MESSAGES:
+      g_value_set_boolean (value,
+          g_atomic_int_get (&timeoverlayparse->post_messages));
+      break;
+    case PROP_STATS:
+      g_value_take_boxed (value, get_stats (timeoverlayparse));
+      break;
+    case PROP_ARCHIVE_LOCATION:
+      GST_OBJECT_LOCK (timeoverlayparse);
+      g_value_set_string (value, timeoverlayparse->archive_location);
+      GST_OBJECT_UNLOCK (timeoverlayparse);
+      break;
+    case PROP_EXPORT_LOCATION:
+      GST_OBJECT_LOCK (timeoverlayparse);
+      g_value_set_string (value, timeoverlayparse->export_location);
+      GST_OBJECT_UNLOCK (timeoverlayparse);
+      break;
+    case PROP_EXPORT_INTERVAL:
+      GST_OBJECT_LOCK (timeoverlayparse);
+      g_value_set_uint64 (value, timeoverlayparse->export_interval);
+      GST_OBJECT_UNLOCK (timeoverlayparse);
+      break;
+    case PROP_MAX_QUEUED:
+      GST_OBJECT_LOCK (timeoverlayparse);
+      g_value_set_uint (value, timeoverlayparse->max_queued);
+      GST_OBJECT_UNLOCK (timeoverlayparse);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+      break;
+  }
+}
+
+static gboolean
+gst_timeoverlayparse_start (GstBaseTransform * trans)
+{
+  GstTimeOverlayParse *timeoverlayparse = GST_TIMEOVERLAYPARSE (trans);
+  GstTimeOverlayParseDecodeMode decode_mode;
+  LatencyArchiveWriter *archive = NULL;
+  LatencySeries *export = NULL;
+  gchar *archive_location, *export_location;
+  GstClockTime export_interval;
+  GError *err = NULL;
+
+  GST_OBJECT_LOCK (timeoverlayparse);
+  decode_mode = timeoverlayparse->decode_mode;
+  archive_location = g_strdup (timeoverlayparse->archive_location);
+  export_location = g_strdup (timeoverlayparse->export_location);
+  export_interval = timeoverlayparse->export_interval;
+  GST_OBJECT_UNLOCK (timeoverlayparse);
+
+  if (archive_location)
+    archive = latency_archive_writer_new (archive_location, &err);
+  if (!err && export_location)
+    export = latency_series_new (export_location, export_interval, &err);
+  g_free (archive_location);
+  g_free (export_location);
+  if (err) {
+    GST_ELEMENT_ERROR (timeoverlayparse, RESOURCE, OPEN_WRITE,
+        ("%s", err->message), (NULL));
+    g_error_free (err);
+    if (archive)
+      latency_archive_writer_close (archive, NULL);
+    return FALSE;
+  }
+
+  g_mutex_lock (&timeoverlayparse->stats_lock);
+  latency_histogram_free (timeoverlayparse->latency_stats);
+  latency_histogram_free (timeoverlayparse->processing_stats);
+  latency_histogram_free (timeoverlayparse->corrected_stats);
+  timeoverlayparse->latency_stats = NULL;
+  timeoverlayparse->processing_stats = NULL;
+  timeoverlayparse->corrected_stats = NULL;
+  gaps_reset (&timeoverlayparse->gaps);
+  timeoverlayparse->dropped = 0;
+  timeoverlayparse->archive = archive;
+  timeoverlayparse->export = export;
+  g_mutex_unlock (&timeoverlayparse->stats_lock);
+
+  timeoverlay_decoder_reset (&timeoverlayparse->decoder);
+  timeoverlayparse->queued = 0;
+  timeoverlayparse->dropped_pending = 0;
+
+  /* A single thread runs the jobs in the order they were pushed */
+  if (decode_mode == GST_TIMEOVERLAYPARSE_DECODE_MODE_ASYNC)
+    timeoverlayparse->async_pool = g_thread_pool_new (decode_job,
+        timeoverlayparse, 1, FALSE, NULL);
+  else if (decode_mode == GST_TIMEOVERLAYPARSE_DECODE_MODE_POOL)
+    timeoverlayparse->pool_stream = decode_pool_stream_new (decode_job,
+        timeoverlayparse);
+
+  return TRUE;
+}
+
+static gboolean
+gst_timeoverlayparse_stop (GstBaseTransform * trans)
+{
+  GstTimeOverlayParse *timeoverlayparse = GST_TIMEOVERLAYPARSE (trans);
+  LatencyArchiveWriter *archive;
+  LatencySeries *export;
+  GstStructure *stats;
+  GError *err = NULL;
+
+  /* Let any frames still queued be decoded so they make it into the stats */
+  if (timeoverlayparse->async_pool) {
+    g_thread_pool_free (timeoverlayparse->async_pool, FALSE, TRUE);
+    timeoverlayparse->async_pool = NULL;
+  }
+  if (timeoverlayparse->pool_stream) {
+    decode_pool_stream_free (timeoverlayparse->pool_stream);
+    timeoverlayparse->pool_stream = NULL;
+  }
+  roi_converter_clear (&timeoverlayparse->roi);
+
+  g_mutex_lock (&timeoverlayparse->stats_lock);
+  timeoverlayparse->dropped += timeoverlayparse->dropped_pending;
+  timeoverlayparse->dropped_pending = 0;
+  archive = timeoverlayparse->archive;
+  timeoverlayparse->archive = NULL;
+  export = timeoverlayparse->export;
+  timeoverlayparse->export = NULL;
+  g_mutex_unlock (&timeoverlayparse->stats_lock);
+  if (archive && !latency_archive_writer_close (archive, &err)) {
+    GST_ELEMENT_WARNING (timeoverlayparse, RESOURCE, WRITE,
+        ("%s", err->message), (NULL));
+    g_clear_error (&err);
+  }
+  if (export && !latency_series_close (export, &err)) {
+    GST_ELEMENT_WARNING (timeoverlayparse, RESOURCE, WRITE,
+        ("%s", err->message), (NULL));
+    g_clear_error (&err);
+  }
+
+  stats = get_stats (timeoverlayparse);
+  GST_INFO_OBJECT (timeoverlayparse, "Statistics: %" GST_PTR_FORMAT, stats);
+  gst_structure_free (stats);
+
+  return TRUE;
 }
 
 typedef struct {
@@ -106,48 +444,412 @@ typedef struct {
   GstClockTime render_realtime;
 } Timestamps;
 
-static GstClockTime
-read_timestamp(int lineoffset, unsigned char* buf, size_t stride, int pxsize)
+/* A bit is set where the first byte of the pixel is bright */
+#define SAMPLE_THRESHOLD 0x80
+
+/* Rebuilds the gather table if the layout of the code region has changed
+ * since the last frame */
+static void
+update_gather_table (TimeOverlayGatherTable * table,
+    const TimeOverlayRegion * region, gint stride, gint pxsize,
+    gboolean (*init) (TimeOverlayGatherTable *, gint, gint, gint, gint,
+        guint8, guint8))
+{
+  if (!timeoverlay_gather_table_matches (table, region->width,
+          region->height, stride, pxsize))
+    init (table, region->width, region->height, stride, pxsize,
+        SAMPLE_THRESHOLD, 0);
+}
+
+/* The whole code is on one line, so decoding is a single short read at the
+ * start of the frame.  Every line carries the same code, the next one is
+ * only tried if the first fails its sync bits or CRC. */
+static gboolean
+read_vitc (const TimeOverlayGatherTable * table, unsigned char* buf,
+    size_t stride, GstClockTime * timestamp, guint32 * sequence)
+{
+  guint8 bits[TIMEOVERLAY_VITC_BITS];
+  int line;
+
+  for (line = 0; line < TIMEOVERLAY_VITC_LINES; line++) {
+    timeoverlay_gather_bits (table, buf, bits);
+    if (timeoverlay_vitc_unpack (bits, timestamp, sequence))
+      return TRUE;
+    buf += stride;
+  }
+  return FALSE;
+}
+
+/* Only the middle of each half of the patch is read, the rest of it is
+ * there to survive scaling down and compression */
+static void
+read_temporal (unsigned char* buf, size_t stride, int pxsize, int width,
+    int height, guint * bit, guint * phase)
+{
+  unsigned char *line = buf + height / 2 * stride;
+  guint level;
+
+  *bit = (line[width / 4 * pxsize] & 0x80) ? 1 : 0;
+  level = line[width * 3 / 4 * pxsize];
+  *phase = (level * (TIMEOVERLAY_TEMPORAL_PHASES - 1) + 127) / 255;
+}
+
+/* A frame queued for decoding off the streaming thread */
+typedef struct {
+  GstBuffer *buffer;
+  GstVideoInfo info;
+  GstTimeOverlayMode mode;
+  GstClockTime clock_time;
+  GstClockTime arrival_time;
+  /* Frames dropped since the previous job was queued */
+  guint dropped_before;
+} DecodeJob;
+
+/* Reads the timestamps from the frame and works out the latency from the
+ * clock time at which it arrived */
+static gboolean
+decode_frame (GstObject * obj, GstVideoFrame * frame, GstTimeOverlayMode mode,
+    TimeOverlayDecoder * decoder, RoiConverter * roi_converter,
+    GstClockTime clock_time, GstTimeOverlayParseResult * result)
+{
+  Timestamps timestamps;
+  guint64 clocks[TIMEOVERLAY_BLOCKS_CLOCKS];
+  guint32 sequence;
+  guint bit, phase;
+  GstClockTime capture_period = 0, period;
+  TimeOverlayRegion region;
+  GstVideoFrame roi, *source;
+  gboolean native, ok = FALSE;
+  unsigned char *buf;
+  gint stride, pxsize;
+
+  result->sequence = -1;
+  result->frame_period = GST_CLOCK_TIME_NONE;
+  if (frame->info.fps_n > 0)
+    capture_period = gst_util_uint64_scale_int (GST_SECOND, frame->info.fps_d,
+        frame->info.fps_n);
+  result->capture_period = capture_period ? capture_period :
+      GST_CLOCK_TIME_NONE;
+
+  if (!timeoverlay_code_region (mode, frame->info.width, frame->info.height,
+          &region)) {
+    GST_WARNING_OBJECT (obj, "Can't read timestamps: video-frame is too "
+        "small");
+    return FALSE;
+  }
+
+  /* Other formats have just the code region converted to GRAY8 */
+  native = timeoverlay_format_is_native (GST_VIDEO_FRAME_FORMAT (frame));
+  if (native) {
+    source = frame;
+  } else if (roi_converter_read (roi_converter, frame, &region, &roi)) {
+    source = &roi;
+  } else {
+    GST_WARNING_OBJECT (obj, "Can't read timestamps: no conversion from %s "
+        "to GRAY8", gst_video_format_to_string (GST_VIDEO_FRAME_FORMAT
+            (frame)));
+    return FALSE;
+  }
+  stride = GST_VIDEO_FRAME_PLANE_STRIDE (source, 0);
+  pxsize = GST_VIDEO_FRAME_COMP_PSTRIDE (source, 0);
+  buf = GST_VIDEO_FRAME_PLANE_DATA (source, 0);
+  buf += region.y * stride + region.x * pxsize;
+
+  if (mode == GST_TIMEOVERLAY_MODE_TEMPORAL) {
+    read_temporal (buf, stride, pxsize, region.width, region.height, &bit,
+        &phase);
+    if (!timeoverlay_temporal_decoder_push (&decoder->temporal, bit, phase,
+            capture_period, &timestamps.render_realtime, &sequence)) {
+      GST_DEBUG_OBJECT (obj, "Can't measure latency: temporal code not "
+          "locked yet");
+      goto out;
+    }
+    GST_DEBUG_OBJECT (obj, "Temporal code: sequence = %u, render_realtime = %"
+        GST_TIME_FORMAT, sequence, GST_TIME_ARGS(timestamps.render_realtime));
+    result->sequence = sequence;
+    /* Until it has been measured between two words the capture framerate
+     * stands in for it, which is no use for telling frames were lost */
+    if (decoder->temporal.period)
+      result->frame_period = decoder->temporal.period;
+    goto done;
+  }
+
+  if (mode == GST_TIMEOVERLAY_MODE_VITC) {
+    update_gather_table (&decoder->vitc, &region, stride, pxsize,
+        timeoverlay_gather_table_init_vitc);
+    if (!read_vitc (&decoder->vitc, buf, stride, &timestamps.render_realtime,
+            &sequence)) {
+      GST_DEBUG_OBJECT (obj, "Can't measure latency: no valid VITC line");
+      goto out;
+    }
+    GST_DEBUG_OBJECT (obj, "Read VITC: sequence = %u, render_realtime = %"
+        GST_TIME_FORMAT, sequence, GST_TIME_ARGS(timestamps.render_realtime));
+    result->sequence = sequence;
+    period = timeoverlay_period_estimator_push (&decoder->period, sequence,
+        timestamps.render_realtime);
+    if (period)
+      result->frame_period = period;
+    goto done;
+  }
+
+  update_gather_table (&decoder->blocks, &region, stride, pxsize,
+      timeoverlay_gather_table_init_blocks);
+  timeoverlay_gather_words (&decoder->blocks, buf, clocks);
+  timestamps.buffer_time = clocks[0];
+  timestamps.stream_time = clocks[1];
+  timestamps.running_time = clocks[2];
+  timestamps.clock_time = clocks[3];
+  timestamps.render_time = clocks[4];
+  timestamps.render_realtime = clocks[5];
+
+  /* The server timestamps its frames at multiples of its frame period,
+   * which isn't necessarily ours */
+  period = timeoverlay_period_estimator_push (&decoder->period, -1,
+      timestamps.buffer_time);
+  if (period) {
+    result->sequence = (timestamps.buffer_time + period / 2) / period;
+    result->frame_period = period;
+  }
+
+  GST_DEBUG_OBJECT (obj, "Read timestamps: buffer_time = %" GST_TIME_FORMAT
+      ", stream_time = %" GST_TIME_FORMAT ", running_time = %" GST_TIME_FORMAT
+      ", clock_time = %" GST_TIME_FORMAT ", render_time = %" GST_TIME_FORMAT
+      ", render_realtime = %" GST_TIME_FORMAT,
+      GST_TIME_ARGS(timestamps.buffer_time),
+      GST_TIME_ARGS(timestamps.stream_time),
+      GST_TIME_ARGS(timestamps.running_time),
+      GST_TIME_ARGS(timestamps.clock_time),
+      GST_TIME_ARGS(timestamps.render_time),
+      GST_TIME_ARGS(timestamps.render_realtime));
+
+done:
+  result->clock_time = clock_time;
+  result->render_realtime = timestamps.render_realtime;
+  result->latency = clock_time - timestamps.render_realtime;
+
+  GST_INFO_OBJECT (obj, "Latency: %" GST_TIME_FORMAT,
+      GST_TIME_ARGS(result->latency));
+  ok = TRUE;
+
+out:
+  if (!native)
+    gst_video_frame_unmap (&roi);
+  return ok;
+}
+
+static void
+gaps_reset (GstTimeOverlayParseGaps * gaps)
+{
+  gaps->sequence = -1;
+  gaps->render_realtime = 0;
+  gaps->undecoded = 0;
+  gaps->arrived = 0;
+  timeoverlay_period_estimator_reset (&gaps->capture);
+}
+
+/* Frames that arrived but couldn't be decoded or were dropped */
+static void
+gaps_skip (GstTimeOverlayParseGaps * gaps, guint64 frames)
+{
+  gaps->undecoded += frames;
+  gaps->arrived += frames;
+}
+
+/* Returns the number of frames lost between the last frame decoded and this
+ * one, and the server's frame period in interval.
+ *
+ * Each frame captured normally moves the sequence on by the capture period
+ * over the server's period, e.g. by 2 for a 50 fps server captured at
+ * 25 fps.  Only frames beyond that step are lost, HdrHistogram's expected
+ * interval.  Frames that arrived but couldn't be decoded aren't lost.  Nor
+ * is a jump in the sequence that render_realtime doesn't agree with, as that
+ * means the server restarted or the code was misread.  Nothing is counted
+ * until both periods are known. */
+static guint64
+count_missing (GstTimeOverlayParseGaps * gaps,
+    const GstTimeOverlayParseResult * result, gint64 * interval)
+{
+  gint64 last = gaps->sequence, frames, period = result->frame_period;
+  gint64 captured = gaps->undecoded + 1, expected;
+  GstClockTimeDiff elapsed;
+  guint64 capture_period;
+
+  /* Measured from the spacing of the frames' capture times when the caps
+   * don't say */
+  gaps->arrived++;
+  capture_period = timeoverlay_period_estimator_push (&gaps->capture,
+      gaps->arrived, result->clock_time);
+  if (GST_CLOCK_TIME_IS_VALID (result->capture_period))
+    capture_period = result->capture_period;
+
+  if (result->sequence < 0) {
+    gaps->undecoded++;
+    return 0;
+  }
+  elapsed = GST_CLOCK_DIFF (gaps->render_realtime, result->render_realtime);
+  gaps->sequence = result->sequence;
+  gaps->render_realtime = result->render_realtime;
+  gaps->undecoded = 0;
+
+  frames = result->sequence - last;
+  if (last < 0 || frames <= 1 || elapsed <= 0 ||
+      !GST_CLOCK_TIME_IS_VALID (result->frame_period) || !capture_period)
+    return 0;
+
+  /* Allowing for render_realtime jittering and drifting a bit */
+  if (ABS (elapsed - frames * period) > period / 2 + elapsed / 100)
+    return 0;
+
+  expected = MAX (1, (gint64) ((captured * capture_period + period / 2) /
+          period));
+  *interval = period;
+  return frames > expected ? frames - expected : 0;
+}
+
+/* Must be called with the stats lock held.  Returns the number of frames
+ * lost before this one. */
+static guint64
+record_latency (LatencyHistogram * raw, LatencyHistogram * corrected,
+    GstTimeOverlayParseGaps * gaps, const GstTimeOverlayParseResult * result)
 {
-  int bit;
-  GstClockTime timestamp = 0;
+  gint64 interval = 0;
+  guint64 missing = count_missing (gaps, result, &interval);
 
-  buf += (lineoffset * 8 + 4) * stride;
+  latency_histogram_record (raw, result->latency);
+  latency_histogram_record_corrected (corrected, result->latency, missing,
+      interval);
+  return missing;
+}
+
+/* Records the frame in the statistics and lets the application know about
+ * it.  result is NULL if the frame couldn't be decoded. */
+static void
+frame_done (GstTimeOverlayParse * overlay, const GstTimeOverlayParseResult * result,
+    GstClockTime arrival_time)
+{
+  GstClockTime processing = gst_util_get_timestamp () - arrival_time;
+  gint64 decoded_realtime = g_get_real_time () * GST_USECOND;
+  GstStructure *s;
+  GError *err = NULL;
+  guint64 missing = 0;
 
-  for (bit = 0; bit < 64; bit++) {
-    char color = buf[bit * pxsize * 8 + 4];
-    timestamp |= (color & 0x80) ?  (guint64) 1 << (63 - bit) : 0;
+  if (result)
+    TIMEOVERLAY_PROBE_PARSE (result->sequence, result->clock_time,
+        result->render_realtime, result->latency);
+
+  g_mutex_lock (&overlay->stats_lock);
+  if (!overlay->latency_stats) {
+    overlay->latency_stats = latency_histogram_new ();
+    overlay->processing_stats = latency_histogram_new ();
+    overlay->corrected_stats = latency_histogram_new ();
+  }
+  if (result)
+    missing = record_latency (overlay->latency_stats,
+        overlay->corrected_stats, &overlay->gaps, result);
+  else
+    gaps_skip (&overlay->gaps, 1);
+  latency_histogram_record (overlay->processing_stats, processing);
+  /* A full disk shouldn't stop the measurement, just the archiving */
+  if (result && overlay->archive &&
+      !latency_archive_writer_append (overlay->archive, result->sequence,
+          result->clock_time, result->latency, &err)) {
+    GST_ELEMENT_WARNING (overlay, RESOURCE, WRITE, ("%s", err->message),
+        ("No more frames will be archived"));
+    g_clear_error (&err);
+    latency_archive_writer_close (overlay->archive, NULL);
+    overlay->archive = NULL;
+  }
+  if (overlay->export && !result) {
+    latency_series_record_undecoded (overlay->export);
+  } else if (overlay->export &&
+      !latency_series_record (overlay->export, result->clock_time,
+          result->latency, missing, &err)) {
+    GST_ELEMENT_WARNING (overlay, RESOURCE, WRITE, ("%s", err->message),
+        ("No more rows will be exported"));
+    g_clear_error (&err);
+    latency_series_close (overlay->export, NULL);
+    overlay->export = NULL;
   }
+  g_mutex_unlock (&overlay->stats_lock);
 
-  return timestamp;
+  if (result && g_atomic_int_get (&overlay->post_messages)) {
+    s = gst_structure_new ("timeoverlayparse",
+        "clock-time", G_TYPE_UINT64, result->clock_time,
+        "render-realtime", G_TYPE_UINT64, result->render_realtime,
+        "latency", G_TYPE_INT64, result->latency,
+        "processing-time", G_TYPE_UINT64, processing,
+        "decoded-realtime", G_TYPE_UINT64, decoded_realtime, NULL);
+    if (result->sequence >= 0)
+      gst_structure_set (s, "sequence", G_TYPE_INT64, result->sequence, NULL);
+    gst_element_post_message (GST_ELEMENT (overlay),
+        gst_message_new_element (GST_OBJECT (overlay), s));
+  }
+}
+
+/* Runs on the element's async thread or on the shared pool */
+static void
+decode_job (gpointer data, gpointer user_data)
+{
+  GstTimeOverlayParse *overlay = user_data;
+  DecodeJob *job = data;
+  GstVideoFrame frame;
+  GstTimeOverlayParseResult result;
+  gboolean decoded = FALSE;
+  guint n;
+
+  /* Dropped frames are accounted for here rather than on the streaming
+   * thread so that they fall into the right gap in the sequence */
+  if (job->dropped_before) {
+    g_mutex_lock (&overlay->stats_lock);
+    gaps_skip (&overlay->gaps, job->dropped_before);
+    overlay->dropped += job->dropped_before;
+    for (n = 0; overlay->export && n < job->dropped_before; n++)
+      latency_series_record_undecoded (overlay->export);
+    g_mutex_unlock (&overlay->stats_lock);
+  }
+
+  if (gst_video_frame_map (&frame, &job->info, job->buffer, GST_MAP_READ)) {
+    decoded = decode_frame (GST_OBJECT (overlay), &frame, job->mode,
+        &overlay->decoder, &overlay->roi, job->clock_time, &result);
+    gst_video_frame_unmap (&frame);
+  } else {
+    GST_WARNING_OBJECT (overlay, "Failed to map frame for decoding");
+  }
+  frame_done (overlay, decoded ? &result : NULL, job->arrival_time);
+
+  gst_buffer_unref (job->buffer);
+  g_slice_free (DecodeJob, job);
+  g_atomic_int_add (&overlay->queued, -1);
 }
 
 static GstFlowReturn
 gst_timeoverlayparse_transform_frame_ip (GstVideoFilter * filter, GstVideoFrame * frame)
 {
   GstTimeOverlayParse *overlay = GST_TIMEOVERLAYPARSE (filter);
-  Timestamps timestamps;
-  unsigned char * imgdata;
 
   GST_DEBUG_OBJECT (overlay, "transform_frame_ip");
 
-  GstClockTime buffer_time, running_time, clock_time;
-  GstClockTimeDiff latency;
+  GstClockTime buffer_time, running_time, clock_time, arrival_time;
   GstSegment *segment = &GST_BASE_TRANSFORM (overlay)->segment;
+  GstTimeOverlayMode mode;
+  GstTimeOverlayParseResult result;
+  gboolean decoded;
+  guint max_queued;
 
+  arrival_time = gst_util_get_timestamp ();
   buffer_time = GST_BUFFER_TIMESTAMP (frame->buffer);
 
+  GST_OBJECT_LOCK (overlay);
+  mode = overlay->mode;
+  max_queued = overlay->max_queued;
+  GST_OBJECT_UNLOCK (overlay);
+
   if (!GST_CLOCK_TIME_IS_VALID (buffer_time)) {
     GST_DEBUG_OBJECT (filter, "Can't measure latency: buffer timestamp is "
         "invalid");
     return GST_FLOW_OK;
   }
 
-  if (frame->info.stride[0] < (8 * frame->info.finfo->pixel_stride[0] * 64)) {
-    GST_WARNING_OBJECT (filter, "Can't read timestamps: video-frame is to narrow");
-    return GST_FLOW_OK;
-  }
-
   GST_DEBUG ("buffer with timestamp %" GST_TIME_FORMAT,
       GST_TIME_ARGS (buffer_time));
 
@@ -163,43 +865,267 @@ gst_timeoverlayparse_transform_frame_ip (GstVideoFilter * filter, GstVideoFrame
       GST_TIME_ARGS(running_time),
       GST_TIME_ARGS(clock_time));
 
-  imgdata = frame->data[0];
-
-  /* Centre Vertically: */
-  imgdata += (frame->info.height - 6 * 8) * frame->info.stride[0] / 2;
-
-  /* Centre Horizontally: */
-  imgdata += (frame->info.width - 64 * 8) * frame->info.finfo->pixel_stride[0]
-      / 2;
-
-  timestamps.buffer_time = read_timestamp (0, imgdata,
-      frame->info.stride[0], frame->info.finfo->pixel_stride[0]);
-  timestamps.stream_time = read_timestamp (1, imgdata,
-      frame->info.stride[0], frame->info.finfo->pixel_stride[0]);
-  timestamps.running_time = read_timestamp (2, imgdata,
-      frame->info.stride[0], frame->info.finfo->pixel_stride[0]);
-  timestamps.clock_time = read_timestamp (3, imgdata,
-      frame->info.stride[0], frame->info.finfo->pixel_stride[0]);
-  timestamps.render_time = read_timestamp (4, imgdata,
-      frame->info.stride[0], frame->info.finfo->pixel_stride[0]);
-  timestamps.render_realtime = read_timestamp (5, imgdata,
-      frame->info.stride[0], frame->info.finfo->pixel_stride[0]);
-
-  GST_DEBUG_OBJECT (filter, "Read timestamps: buffer_time = %" GST_TIME_FORMAT
-      ", stream_time = %" GST_TIME_FORMAT ", running_time = %" GST_TIME_FORMAT
-      ", clock_time = %" GST_TIME_FORMAT ", render_time = %" GST_TIME_FORMAT
-      ", render_realtime = %" GST_TIME_FORMAT,
-      GST_TIME_ARGS(timestamps.buffer_time),
-      GST_TIME_ARGS(timestamps.stream_time),
-      GST_TIME_ARGS(timestamps.running_time),
-      GST_TIME_ARGS(timestamps.clock_time),
-      GST_TIME_ARGS(timestamps.render_time),
-      GST_TIME_ARGS(timestamps.render_realtime));
+  TIMEOVERLAY_PROBE_ARRIVE (clock_time, arrival_time);
+
+  if (overlay->async_pool || overlay->pool_stream) {
+    DecodeJob *job;
 
-  latency = clock_time - timestamps.render_realtime;
+    /* Rather than holding on to more buffers and starving upstream's pool
+     * when decoding falls behind */
+    if (g_atomic_int_get (&overlay->queued) >= (gint) max_queued) {
+      GST_DEBUG_OBJECT (overlay, "Dropping frame: %u already queued for "
+          "decoding", max_queued);
+      overlay->dropped_pending++;
+      return GST_FLOW_OK;
+    }
 
-  GST_INFO_OBJECT (filter, "Latency: %" GST_TIME_FORMAT,
-      GST_TIME_ARGS(latency));
+    /* The job holds a ref on the buffer until it has been decoded */
+    job = g_slice_new (DecodeJob);
+    job->buffer = gst_buffer_ref (frame->buffer);
+    job->info = frame->info;
+    job->mode = mode;
+    job->clock_time = clock_time;
+    job->arrival_time = arrival_time;
+    job->dropped_before = overlay->dropped_pending;
+    overlay->dropped_pending = 0;
+    g_atomic_int_inc (&overlay->queued);
+
+    if (overlay->async_pool)
+      g_thread_pool_push (overlay->async_pool, job, NULL);
+    else
+      decode_pool_stream_push (overlay->pool_stream, job);
+    return GST_FLOW_OK;
+  }
+
+  decoded = decode_frame (GST_OBJECT (overlay), frame, mode,
+      &overlay->decoder, &overlay->roi, clock_time, &result);
+  frame_done (overlay, decoded ? &result : NULL, arrival_time);
 
   return GST_FLOW_OK;
 }
+
+/* Pad probe API */
+
+struct _GstTimeOverlayParseProbe
+{
+  GstPad *pad;
+  gulong id;
+  GstTimeOverlayMode mode;
+  GstTimeOverlayParseProbeCallback callback;
+  gpointer user_data;
+  GDestroyNotify notify;
+
+  /* Only touched from the streaming thread */
+  GstVideoInfo info;
+  gboolean have_info;
+  GstSegment segment;
+  TimeOverlayDecoder decoder;
+  RoiConverter roi;
+
+  GMutex stats_lock;
+  LatencyHistogram *latency_stats;
+  LatencyHistogram *corrected_stats;
+  GstTimeOverlayParseGaps gaps;
+};
+
+static void
+probe_free (gpointer data)
+{
+  GstTimeOverlayParseProbe *probe = data;
+
+  if (probe->notify)
+    probe->notify (probe->user_data);
+  latency_histogram_free (probe->latency_stats);
+  latency_histogram_free (probe->corrected_stats);
+  roi_converter_clear (&probe->roi);
+  g_mutex_clear (&probe->stats_lock);
+  gst_object_unref (probe->pad);
+  g_slice_free (GstTimeOverlayParseProbe, probe);
+}
+
+static void
+probe_set_caps (GstTimeOverlayParseProbe * probe, GstCaps * caps)
+{
+  probe->have_info = caps && gst_video_info_from_caps (&probe->info, caps);
+  if (!probe->have_info)
+    GST_WARNING_OBJECT (probe->pad, "Can't decode: caps %" GST_PTR_FORMAT
+        " aren't raw video", caps);
+}
+
+static void
+probe_decode_buffer (GstTimeOverlayParseProbe * probe, GstBuffer * buffer)
+{
+  GstTimeOverlayParseResult result;
+  GstClockTime buffer_time, running_time, clock_time;
+  GstElement *element;
+  GstVideoFrame frame;
+  gboolean decoded;
+
+  buffer_time = GST_BUFFER_TIMESTAMP (buffer);
+  if (!probe->have_info || !GST_CLOCK_TIME_IS_VALID (buffer_time))
+    return;
+
+  element = gst_pad_get_parent_element (probe->pad);
+  if (!element)
+    return;
+  running_time = gst_segment_to_running_time (&probe->segment,
+      GST_FORMAT_TIME, buffer_time);
+  clock_time = running_time + gst_element_get_base_time (element);
+  gst_object_unref (element);
+
+  if (!gst_video_frame_map (&frame, &probe->info, buffer, GST_MAP_READ)) {
+    GST_WARNING_OBJECT (probe->pad, "Failed to map frame for decoding");
+    return;
+  }
+  decoded = decode_frame (GST_OBJECT (probe->pad), &frame, probe->mode,
+      &probe->decoder, &probe->roi, clock_time, &result);
+  gst_video_frame_unmap (&frame);
+  if (!decoded) {
+    g_mutex_lock (&probe->stats_lock);
+    gaps_skip (&probe->gaps, 1);
+    g_mutex_unlock (&probe->stats_lock);
+    return;
+  }
+  TIMEOVERLAY_PROBE_PARSE (result.sequence, result.clock_time,
+      result.render_realtime, result.latency);
+
+  g_mutex_lock (&probe->stats_lock);
+  if (!probe->latency_stats) {
+    probe->latency_stats = latency_histogram_new ();
+    probe->corrected_stats = latency_histogram_new ();
+  }
+  record_latency (probe->latency_stats, probe->corrected_stats, &probe->gaps,
+      &result);
+  g_mutex_unlock (&probe->stats_lock);
+
+  if (probe->callback)
+    probe->callback (probe->pad, &result, probe->user_data);
+}
+
+static GstPadProbeReturn
+decode_probe (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+  GstTimeOverlayParseProbe *probe = user_data;
+  GstBufferList *list;
+  GstEvent *event;
+  GstCaps *caps;
+  guint n, len;
+
+  if (info->type & GST_PAD_PROBE_TYPE_BUFFER) {
+    probe_decode_buffer (probe, GST_PAD_PROBE_INFO_BUFFER (info));
+    return GST_PAD_PROBE_OK;
+  }
+  if (info->type & GST_PAD_PROBE_TYPE_BUFFER_LIST) {
+    list = GST_PAD_PROBE_INFO_BUFFER_LIST (info);
+    len = gst_buffer_list_length (list);
+    for (n = 0; n < len; n++)
+      probe_decode_buffer (probe, gst_buffer_list_get (list, n));
+    return GST_PAD_PROBE_OK;
+  }
+
+  event = GST_PAD_PROBE_INFO_EVENT (info);
+  switch (GST_EVENT_TYPE (event)) {
+    case GST_EVENT_CAPS:
+      gst_event_parse_caps (event, &caps);
+      probe_set_caps (probe, caps);
+      break;
+    case GST_EVENT_SEGMENT:
+      gst_event_copy_segment (event, &probe->segment);
+      break;
+    default:
+      break;
+  }
+  return GST_PAD_PROBE_OK;
+}
+
+/**
+ * gst_timeoverlayparse_probe_attach:
+ * @pad: a pad carrying raw video
+ * @mode: how the timestamps were drawn by timestampoverlay
+ * @callback: (allow-none): called on the streaming thread for every frame
+ *     decoded
+ * @user_data: passed to @callback
+ * @notify: (allow-none): called to free @user_data once the probe is
+ *     detached
+ *
+ * Decodes the timestamps drawn by timestampoverlay from every buffer that
+ * passes through @pad, alone or in a buffer list, without changing the
+ * pipeline.  Frames are mapped
+ * read-only, so nothing is copied.
+ *
+ * Returns: the probe, to be passed to gst_timeoverlayparse_probe_detach()
+ */
+GstTimeOverlayParseProbe *
+gst_timeoverlayparse_probe_attach (GstPad * pad, GstTimeOverlayMode mode,
+    GstTimeOverlayParseProbeCallback callback, gpointer user_data,
+    GDestroyNotify notify)
+{
+  GstTimeOverlayParseProbe *probe;
+  GstEvent *event;
+  GstCaps *caps;
+
+  g_return_val_if_fail (GST_IS_PAD (pad), NULL);
+
+  probe = g_slice_new0 (GstTimeOverlayParseProbe);
+  probe->pad = gst_object_ref (pad);
+  probe->mode = mode;
+  probe->callback = callback;
+  probe->user_data = user_data;
+  probe->notify = notify;
+  g_mutex_init (&probe->stats_lock);
+  gaps_reset (&probe->gaps);
+  gst_segment_init (&probe->segment, GST_FORMAT_TIME);
+  timeoverlay_decoder_reset (&probe->decoder);
+
+  /* The stream may already be running, in which case we won't see the caps
+   * and segment events go past */
+  caps = gst_pad_get_current_caps (pad);
+  if (caps) {
+    probe_set_caps (probe, caps);
+    gst_caps_unref (caps);
+  }
+  event = gst_pad_get_sticky_event (pad, GST_EVENT_SEGMENT, 0);
+  if (event) {
+    gst_event_copy_segment (event, &probe->segment);
+    gst_event_unref (event);
+  }
+
+  probe->id = gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER |
+      GST_PAD_PROBE_TYPE_BUFFER_LIST | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM,
+      decode_probe, probe, probe_free);
+  return probe;
+}
+
+/**
+ * gst_timeoverlayparse_probe_get_stats:
+ * @probe: a probe from gst_timeoverlayparse_probe_attach()
+ *
+ * Returns: the latency statistics of the frames decoded so far, in the
+ *     same form as the "stats" property of timeoverlayparse
+ */
+GstStructure *
+gst_timeoverlayparse_probe_get_stats (GstTimeOverlayParseProbe * probe)
+{
+  GstStructure *s = gst_structure_new_empty ("timeoverlayparse-stats");
+
+  g_mutex_lock (&probe->stats_lock);
+  if (probe->latency_stats) {
+    latency_histogram_to_structure (probe->latency_stats, s, "latency");
+    latency_histogram_to_structure (probe->corrected_stats, s,
+        "corrected-latency");
+  }
+  g_mutex_unlock (&probe->stats_lock);
+  return s;
+}
+
+/**
+ * gst_timeoverlayparse_probe_detach:
+ * @probe: a probe from gst_timeoverlayparse_probe_attach()
+ *
+ * Removes the probe.  @probe must not be used afterwards.
+ */
+void
+gst_timeoverlayparse_probe_detach (GstTimeOverlayParseProbe * probe)
+{
+  gst_pad_remove_probe (probe->pad, probe->id);
+}
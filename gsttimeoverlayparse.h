@@ -23,6 +23,13 @@
 #include <gst/video/video.h>
 #include <gst/video/gstvideofilter.h>
 
+#include "gsttimeoverlaycodec.h"
+#include "latencystats.h"
+#include "decodepool.h"
+#include "latencyarchive.h"
+#include "latencyseries.h"
+#include "roiconvert.h"
+
 G_BEGIN_DECLS
 
 #define GST_TYPE_TIMEOVERLAYPARSE   (gst_timeoverlayparse_get_type())
@@ -31,12 +38,73 @@ G_BEGIN_DECLS
 #define GST_IS_TIMEOVERLAYPARSE(obj)   (G_TYPE_CHECK_INSTANCE_TYPE((obj),GST_TYPE_TIMEOVERLAYPARSE))
 #define GST_IS_TIMEOVERLAYPARSE_CLASS(obj)   (G_TYPE_CHECK_CLASS_TYPE((klass),GST_TYPE_TIMEOVERLAYPARSE))
 
+#define GST_TYPE_TIMEOVERLAYPARSE_DECODE_MODE (gst_timeoverlayparse_decode_mode_get_type())
+
 typedef struct _GstTimeOverlayParse GstTimeOverlayParse;
 typedef struct _GstTimeOverlayParseClass GstTimeOverlayParseClass;
 
+typedef enum {
+  GST_TIMEOVERLAYPARSE_DECODE_MODE_INLINE,
+  GST_TIMEOVERLAYPARSE_DECODE_MODE_ASYNC,
+  GST_TIMEOVERLAYPARSE_DECODE_MODE_POOL
+} GstTimeOverlayParseDecodeMode;
+
+/* The last frame decoded, to count the frames missing before the next one
+ * for the corrected statistics.  undecoded counts the frames that arrived
+ * since without a sequence number.  arrived counts every frame, for
+ * measuring the capture period when the caps don't give it. */
+typedef struct {
+  gint64 sequence;
+  GstClockTime render_realtime;
+  guint64 undecoded;
+  gint64 arrived;
+  TimeOverlayPeriodEstimator capture;
+} GstTimeOverlayParseGaps;
+
 struct _GstTimeOverlayParse
 {
   GstVideoFilter base_timeoverlayparse;
+
+  GstTimeOverlayMode mode;
+  GstTimeOverlayParseDecodeMode decode_mode;
+  gboolean post_messages;
+
+  /* Where frames are decoded when decode_mode isn't inline.  At most
+   * max_queued frames wait there, the streaming thread drops any more and
+   * tells the next job how many it dropped in dropped_pending. */
+  GThreadPool *async_pool;
+  DecodePoolStream *pool_stream;
+  guint max_queued;
+  gint queued;
+  guint dropped_pending;
+
+  /* Gather tables, temporal mode state and the converter for formats we
+   * can't read directly, only touched by whichever thread is decoding */
+  TimeOverlayDecoder decoder;
+  RoiConverter roi;
+
+  /* Latency read from the frames and the time from the frame arriving to it
+   * being decoded.  Allocated by the decoding thread when it records the
+   * first frame, so they end up local to it. */
+  GMutex stats_lock;
+  LatencyHistogram *latency_stats;
+  LatencyHistogram *processing_stats;
+  /* Latency with the frames missing from the sequence back-filled */
+  LatencyHistogram *corrected_stats;
+  GstTimeOverlayParseGaps gaps;
+  /* Frames dropped because too many were waiting to be decoded */
+  guint64 dropped;
+
+  /* Every decoded frame is appended here if archive-location is set.
+   * Protected by stats_lock. */
+  gchar *archive_location;
+  LatencyArchiveWriter *archive;
+
+  /* Per-interval summary written if export-location is set.  Protected by
+   * stats_lock. */
+  gchar *export_location;
+  GstClockTime export_interval;
+  LatencySeries *export;
 };
 
 struct _GstTimeOverlayParseClass
@@ -45,6 +113,36 @@ struct _GstTimeOverlayParseClass
 };
 
 GType gst_timeoverlayparse_get_type (void);
+GType gst_timeoverlayparse_decode_mode_get_type (void);
+
+/* What was read from a frame.  frame_period is the server's, worked out
+ * from the codes read so far, and GST_CLOCK_TIME_NONE until it is known.
+ * sequence is -1 if it isn't known: blocks mode carries none, so there it
+ * is the buffer timestamp divided by frame_period.  capture_period is from
+ * the caps, GST_CLOCK_TIME_NONE if they don't give a framerate. */
+typedef struct {
+  GstClockTime clock_time;
+  GstClockTime render_realtime;
+  GstClockTimeDiff latency;
+  gint64 sequence;
+  GstClockTime frame_period;
+  GstClockTime capture_period;
+} GstTimeOverlayParseResult;
+
+
+/* Measuring latency without a timeoverlayparse element: attach a probe to
+ * any raw video pad of an existing pipeline instead */
+typedef struct _GstTimeOverlayParseProbe GstTimeOverlayParseProbe;
+
+typedef void (*GstTimeOverlayParseProbeCallback) (GstPad * pad,
+    const GstTimeOverlayParseResult * result, gpointer user_data);
+
+GstTimeOverlayParseProbe *gst_timeoverlayparse_probe_attach (GstPad * pad,
+    GstTimeOverlayMode mode, GstTimeOverlayParseProbeCallback callback,
+    gpointer user_data, GDestroyNotify notify);
+GstStructure *gst_timeoverlayparse_probe_get_stats (
+    GstTimeOverlayParseProbe * probe);
+void gst_timeoverlayparse_probe_detach (GstTimeOverlayParseProbe * probe);
 
 G_END_DECLS
 
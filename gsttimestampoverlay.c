@@ -38,14 +38,21 @@
 #include <gst/video/video.h>
 #include <gst/video/gstvideofilter.h>
 #include "gsttimestampoverlay.h"
+#include "timeoverlayprobes.h"
 
 #include <string.h>
+#include <time.h>
 
 GST_DEBUG_CATEGORY_STATIC (gst_timestampoverlay_debug_category);
 #define GST_CAT_DEFAULT gst_timestampoverlay_debug_category
 
 /* prototypes */
+static void gst_timestampoverlay_set_property (GObject * object,
+    guint property_id, const GValue * value, GParamSpec * pspec);
+static void gst_timestampoverlay_get_property (GObject * object,
+    guint property_id, GValue * value, GParamSpec * pspec);
 static void gst_timestampoverlay_dispose (GObject *object);
+static gboolean gst_timestampoverlay_start (GstBaseTransform * trans);
 static gboolean gst_timestampoverlay_src_event (GstBaseTransform *
     basetransform, GstEvent * event);
 static GstFlowReturn gst_timestampoverlay_transform_frame_ip (GstVideoFilter * filter,
@@ -55,19 +62,43 @@ static gboolean gst_timestampoverlay_set_clock (GstElement * element,
 
 enum
 {
-  PROP_0
+  PROP_0,
+  PROP_MODE,
+  PROP_CLOCK_MAPPING,
+  PROP_MAPPING_ERROR
 };
 
-/* pad templates */
+#define DEFAULT_MODE GST_TIMEOVERLAY_MODE_BLOCKS
+#define DEFAULT_CLOCK_MAPPING GST_TIMESTAMPOVERLAY_CLOCK_MAPPING_SLAVE
 
-/* FIXME: add/remove formats you can handle */
-#define VIDEO_SRC_CAPS \
-    GST_VIDEO_CAPS_MAKE("{RGB, BGR, BGRx, xBGR, RGB, RGBx, xRGB, RGB15, RGB16, YUY2}")
+/* Number of clock_gettime sandwiches taken per sample.  The one with the
+ * smallest gap between the two REALTIME reads is kept. */
+#define SANDWICHES_PER_SAMPLE 16
 
-/* FIXME: add/remove formats you can handle */
-#define VIDEO_SINK_CAPS \
-    GST_VIDEO_CAPS_MAKE("{RGB, BGR, BGRx, xBGR, RGB, RGBx, xRGB, RGB15, RGB16, YUY2}")
+/* A sample that disagrees with the mapping by more than this means that
+ * REALTIME has been stepped, so we start again from scratch. */
+#define MAX_MAPPING_RESIDUAL GST_MSECOND
 
+GType
+gst_timestampoverlay_clock_mapping_get_type (void)
+{
+  static GType type = 0;
+  static const GEnumValue values[] = {
+    {GST_TIMESTAMPOVERLAY_CLOCK_MAPPING_SLAVE,
+        "Slave a REALTIME GstSystemClock to the pipeline clock", "slave"},
+    {GST_TIMESTAMPOVERLAY_CLOCK_MAPPING_CROSS_TIMESTAMP,
+        "Fit a linear map from periodic cross-timestamps of the pipeline "
+        "clock and REALTIME", "cross-timestamp"},
+    {0, NULL, NULL}
+  };
+
+  if (g_once_init_enter (&type)) {
+    GType tmp = g_enum_register_static ("GstTimeStampOverlayClockMapping",
+        values);
+    g_once_init_leave (&type, tmp);
+  }
+  return type;
+}
 
 /* class initialization */
 
@@ -82,25 +113,46 @@ gst_timestampoverlay_class_init (GstTimeStampOverlayClass * klass)
   GstElementClass *gstelement_class = GST_ELEMENT_CLASS (klass);
   GstBaseTransformClass *base_transform_class = GST_BASE_TRANSFORM_CLASS (klass);
   GstVideoFilterClass *video_filter_class = GST_VIDEO_FILTER_CLASS (klass);
+  GstCaps *caps;
 
   /* Setting up pads and setting metadata should be moved to
      base_class_init if you intend to subclass this class. */
+  caps = timeoverlay_video_caps ();
   gst_element_class_add_pad_template (gstelement_class,
-      gst_pad_template_new ("src", GST_PAD_SRC, GST_PAD_ALWAYS,
-        gst_caps_from_string (VIDEO_SRC_CAPS)));
+      gst_pad_template_new ("src", GST_PAD_SRC, GST_PAD_ALWAYS, caps));
   gst_element_class_add_pad_template (gstelement_class,
-      gst_pad_template_new ("sink", GST_PAD_SINK, GST_PAD_ALWAYS,
-        gst_caps_from_string (VIDEO_SINK_CAPS)));
+      gst_pad_template_new ("sink", GST_PAD_SINK, GST_PAD_ALWAYS, caps));
+  gst_caps_unref (caps);
 
   gst_element_class_set_static_metadata (gstelement_class,
       "Timestampoverlay", "Generic", "Draws the various timestamps on the "
       "video so they can be read off the video afterwards",
       "William Manley <will@williammanley.net>");
 
+  gobject_class->set_property = gst_timestampoverlay_set_property;
+  gobject_class->get_property = gst_timestampoverlay_get_property;
   gobject_class->dispose = GST_DEBUG_FUNCPTR (gst_timestampoverlay_dispose);
   gstelement_class->set_clock = GST_DEBUG_FUNCPTR (gst_timestampoverlay_set_clock);
+  base_transform_class->start = GST_DEBUG_FUNCPTR (gst_timestampoverlay_start);
   base_transform_class->src_event = GST_DEBUG_FUNCPTR (gst_timestampoverlay_src_event);
   video_filter_class->transform_frame_ip = GST_DEBUG_FUNCPTR (gst_timestampoverlay_transform_frame_ip);
+
+  g_object_class_install_property (gobject_class, PROP_MODE,
+      g_param_spec_enum ("mode", "Mode",
+          "How the timestamps are drawn onto the video",
+          GST_TYPE_TIMEOVERLAY_MODE, DEFAULT_MODE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_CLOCK_MAPPING,
+      g_param_spec_enum ("clock-mapping", "Clock mapping",
+          "How render_realtime is derived from the pipeline clock",
+          GST_TYPE_TIMESTAMPOVERLAY_CLOCK_MAPPING, DEFAULT_CLOCK_MAPPING,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_MAPPING_ERROR,
+      g_param_spec_uint64 ("mapping-error", "Mapping error",
+          "Estimated error of the cross-timestamp clock mapping in ns "
+          "(clock-mapping=cross-timestamp only)",
+          0, G_MAXUINT64, GST_CLOCK_TIME_NONE,
+          G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
 }
 
 static void
@@ -113,6 +165,63 @@ gst_timestampoverlay_init (GstTimeStampOverlay *timestampoverlay)
       "clock-type", GST_CLOCK_TYPE_REALTIME, NULL);
   GST_OBJECT_FLAG_SET (timestampoverlay->realtime_clock,
       GST_CLOCK_FLAG_CAN_SET_MASTER);
+
+  timestampoverlay->mode = DEFAULT_MODE;
+  timestampoverlay->sequence = 0;
+  timestampoverlay->clock_mapping = DEFAULT_CLOCK_MAPPING;
+  timestampoverlay->n_samples = 0;
+  timestampoverlay->mapping_error = GST_CLOCK_TIME_NONE;
+}
+
+static void
+gst_timestampoverlay_set_property (GObject * object, guint property_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  GstTimeStampOverlay *timestampoverlay = GST_TIMESTAMPOVERLAY (object);
+
+  switch (property_id) {
+    case PROP_MODE:
+      GST_OBJECT_LOCK (timestampoverlay);
+      timestampoverlay->mode = g_value_get_enum (value);
+      GST_OBJECT_UNLOCK (timestampoverlay);
+      break;
+    case PROP_CLOCK_MAPPING:
+      GST_OBJECT_LOCK (timestampoverlay);
+      timestampoverlay->clock_mapping = g_value_get_enum (value);
+      GST_OBJECT_UNLOCK (timestampoverlay);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_timestampoverlay_get_property (GObject * object, guint property_id,
+    GValue * value, GParamSpec * pspec)
+{
+  GstTimeStampOverlay *timestampoverlay = GST_TIMESTAMPOVERLAY (object);
+
+  switch (property_id) {
+    case PROP_MODE:
+      GST_OBJECT_LOCK (timestampoverlay);
+      g_value_set_enum (value, timestampoverlay->mode);
+      GST_OBJECT_UNLOCK (timestampoverlay);
+      break;
+    case PROP_CLOCK_MAPPING:
+      GST_OBJECT_LOCK (timestampoverlay);
+      g_value_set_enum (value, timestampoverlay->clock_mapping);
+      GST_OBJECT_UNLOCK (timestampoverlay);
+      break;
+    case PROP_MAPPING_ERROR:
+      GST_OBJECT_LOCK (timestampoverlay);
+      g_value_set_uint64 (value, timestampoverlay->mapping_error);
+      GST_OBJECT_UNLOCK (timestampoverlay);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+      break;
+  }
 }
 
 static void
@@ -120,6 +229,18 @@ gst_timestampoverlay_dispose (GObject *object)
 {
   GstTimeStampOverlay *timeoverlay = GST_TIMESTAMPOVERLAY (object);
   g_clear_object (&timeoverlay->realtime_clock);
+  roi_converter_clear (&timeoverlay->roi);
+
+  G_OBJECT_CLASS (gst_timestampoverlay_parent_class)->dispose (object);
+}
+
+static gboolean
+gst_timestampoverlay_start (GstBaseTransform * trans)
+{
+  GstTimeStampOverlay *timestampoverlay = GST_TIMESTAMPOVERLAY (trans);
+
+  timestampoverlay->sequence = 0;
+  return TRUE;
 }
 
 static gboolean
@@ -141,6 +262,126 @@ gst_timestampoverlay_src_event (GstBaseTransform * basetransform, GstEvent * eve
       (basetransform, event);
 }
 
+static GstClockTime
+get_realtime (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_REALTIME, &ts);
+  return GST_TIMESPEC_TO_TIME (ts);
+}
+
+/* Read the clock between two reads of REALTIME, SANDWICHES_PER_SAMPLE times,
+ * and keep the tightest pair.  Returns half the width of the sandwich, which
+ * bounds the error of the pair. */
+static GstClockTime
+take_clock_sample (GstClock * clock, GstTimeStampOverlayClockSample * sample)
+{
+  GstClockTime before, clock_time, after, gap, min_gap = GST_CLOCK_TIME_NONE;
+  int n;
+
+  for (n = 0; n < SANDWICHES_PER_SAMPLE; n++) {
+    before = get_realtime ();
+    clock_time = gst_clock_get_time (clock);
+    after = get_realtime ();
+
+    if (after < before)
+      continue;
+    gap = after - before;
+    if (gap < min_gap) {
+      min_gap = gap;
+      sample->clock_time = clock_time;
+      sample->realtime = before + gap / 2;
+    }
+  }
+  if (!GST_CLOCK_TIME_IS_VALID (min_gap))
+    return GST_CLOCK_TIME_NONE;
+  return min_gap / 2;
+}
+
+static GstClockTime
+map_clock_time_unlocked (GstTimeStampOverlay * overlay, GstClockTime clock_time)
+{
+  GstClockTimeDiff dt = GST_CLOCK_DIFF (overlay->map_clock_ref, clock_time);
+  return overlay->map_realtime_ref + (GstClockTimeDiff) (dt * overlay->map_rate);
+}
+
+/* Least-squares fit of REALTIME against the clock over the sample window.
+ * Fitting the deviation from a rate of 1 relative to the first sample keeps
+ * everything well within double precision. */
+static void
+fit_clock_mapping_unlocked (GstTimeStampOverlay * overlay)
+{
+  GstTimeStampOverlayClockSample *s = overlay->samples;
+  guint n, count = overlay->n_samples;
+  gdouble x, y, mean_x = 0, mean_y = 0, sxx = 0, sxy = 0, slope = 0;
+
+  for (n = 0; n < count; n++) {
+    mean_x += GST_CLOCK_DIFF (s[0].clock_time, s[n].clock_time);
+    mean_y += GST_CLOCK_DIFF (s[0].realtime, s[n].realtime) -
+        GST_CLOCK_DIFF (s[0].clock_time, s[n].clock_time);
+  }
+  mean_x /= count;
+  mean_y /= count;
+
+  for (n = 0; n < count; n++) {
+    x = GST_CLOCK_DIFF (s[0].clock_time, s[n].clock_time) - mean_x;
+    y = GST_CLOCK_DIFF (s[0].realtime, s[n].realtime) -
+        GST_CLOCK_DIFF (s[0].clock_time, s[n].clock_time) - mean_y;
+    sxx += x * x;
+    sxy += x * y;
+  }
+  if (sxx > 0)
+    slope = sxy / sxx;
+
+  overlay->map_clock_ref = s[0].clock_time + (GstClockTimeDiff) mean_x;
+  overlay->map_realtime_ref = s[0].realtime + (GstClockTimeDiff) (mean_x + mean_y);
+  overlay->map_rate = 1.0 + slope;
+}
+
+/* Must be called with the object lock held */
+static void
+update_clock_mapping (GstTimeStampOverlay * overlay, GstClock * clock)
+{
+  GstTimeStampOverlayClockSample sample;
+  GstClockTime sample_error, residual = 0;
+  GstClockTimeDiff diff;
+
+  sample_error = take_clock_sample (clock, &sample);
+  if (!GST_CLOCK_TIME_IS_VALID (sample_error)) {
+    GST_WARNING_OBJECT (overlay, "Failed to cross-timestamp %" GST_PTR_FORMAT,
+        clock);
+    return;
+  }
+
+  if (overlay->n_samples > 0) {
+    diff = GST_CLOCK_DIFF (map_clock_time_unlocked (overlay,
+            sample.clock_time), sample.realtime);
+    residual = ABS (diff);
+    if (residual > MAX_MAPPING_RESIDUAL) {
+      GST_WARNING_OBJECT (overlay, "REALTIME jumped by %" GST_STIME_FORMAT
+          ", resetting clock mapping", GST_STIME_ARGS (diff));
+      overlay->n_samples = 0;
+      residual = 0;
+    }
+  }
+
+  if (overlay->n_samples == GST_TIMESTAMPOVERLAY_MAX_CLOCK_SAMPLES) {
+    memmove (&overlay->samples[0], &overlay->samples[1],
+        sizeof (overlay->samples[0]) * (overlay->n_samples - 1));
+    overlay->n_samples--;
+  }
+  overlay->samples[overlay->n_samples++] = sample;
+  fit_clock_mapping_unlocked (overlay);
+
+  /* The residual is how far the previous mapping was off when it was last
+   * used, the sample error how well we could possibly know it */
+  overlay->mapping_error = residual + sample_error;
+
+  GST_INFO_OBJECT (overlay, "Clock mapping from %u samples: rate %.9f, "
+      "sample error %" G_GUINT64_FORMAT " ns, residual %" G_GUINT64_FORMAT
+      " ns", overlay->n_samples, overlay->map_rate, sample_error, residual);
+}
+
 static gboolean
 gst_timestampoverlay_set_clock (GstElement * element, GstClock * clock)
 {
@@ -148,6 +389,15 @@ gst_timestampoverlay_set_clock (GstElement * element, GstClock * clock)
 
   GST_DEBUG_OBJECT (timestampoverlay, "set_clock (%" GST_PTR_FORMAT ")", clock);
 
+  /* Take the first cross-timestamp now so that even the first frame gets an
+   * accurate render_realtime */
+  GST_OBJECT_LOCK (timestampoverlay);
+  timestampoverlay->n_samples = 0;
+  timestampoverlay->mapping_error = GST_CLOCK_TIME_NONE;
+  if (clock)
+    update_clock_mapping (timestampoverlay, clock);
+  GST_OBJECT_UNLOCK (timestampoverlay);
+
   if (gst_clock_set_master (timestampoverlay->realtime_clock, clock)) {
     if (clock) {
       /* gst_clock_set_master is asynchronous and may take some time to sync.
@@ -183,6 +433,43 @@ draw_timestamp(int lineoffset, GstClockTime timestamp, unsigned char* buf,
   }
 }
 
+/* Each bit covers 1/TIMEOVERLAY_VITC_BITS of the width of the line */
+static void
+draw_vitc (GstClockTime timestamp, guint32 sequence, unsigned char* buf,
+    size_t stride, int pxsize, int width)
+{
+  guint8 bits[TIMEOVERLAY_VITC_BITS];
+  int bit, line, start, end;
+
+  timeoverlay_vitc_pack (timestamp, sequence, bits);
+
+  for (line = 0; line < TIMEOVERLAY_VITC_LINES; line++) {
+    for (bit = 0; bit < TIMEOVERLAY_VITC_BITS; bit++) {
+      start = bit * width / TIMEOVERLAY_VITC_BITS;
+      end = (bit + 1) * width / TIMEOVERLAY_VITC_BITS;
+      memset(buf + start * pxsize, bits[bit] * 255, (end - start) * pxsize);
+    }
+    buf += stride;
+  }
+}
+
+/* The data bit is drawn black or white on the left half of the region and the
+ * phase as a grey level on the right half */
+static void
+draw_temporal (guint8 bit, guint phase, unsigned char* buf, size_t stride,
+    int pxsize, int width, int height)
+{
+  int line;
+
+  for (line = 0; line < height; line++) {
+    memset(buf, bit * 255, width / 2 * pxsize);
+    memset(buf + width / 2 * pxsize,
+        phase * 255 / (TIMEOVERLAY_TEMPORAL_PHASES - 1),
+        (width - width / 2) * pxsize);
+    buf += stride;
+  }
+}
+
 static GstFlowReturn
 gst_timestampoverlay_transform_frame_ip (GstVideoFilter * filter, GstVideoFrame * frame)
 {
@@ -193,9 +480,21 @@ gst_timestampoverlay_transform_frame_ip (GstVideoFilter * filter, GstVideoFrame
   GstClockTime buffer_time, stream_time, running_time, clock_time, latency,
       render_time, render_realtime;
   GstSegment *segment = &GST_BASE_TRANSFORM (overlay)->segment;
+  GstTimeOverlayMode mode;
+  guint32 sequence;
+  TimeOverlayRegion region;
+  GstVideoFrame roi, *target;
+  gboolean native;
+  size_t stride;
+  int pxsize;
   unsigned char * imgdata;
 
   buffer_time = GST_BUFFER_TIMESTAMP (frame->buffer);
+  sequence = overlay->sequence++;
+
+  GST_OBJECT_LOCK (overlay);
+  mode = overlay->mode;
+  GST_OBJECT_UNLOCK (overlay);
 
   if (!GST_CLOCK_TIME_IS_VALID (buffer_time)) {
     GST_DEBUG_OBJECT (filter, "Can't draw timestamps: buffer timestamp is "
@@ -203,8 +502,10 @@ gst_timestampoverlay_transform_frame_ip (GstVideoFilter * filter, GstVideoFrame
     return GST_FLOW_OK;
   }
 
-  if (frame->info.stride[0] < (8 * frame->info.finfo->pixel_stride[0] * 64)) {
-    GST_WARNING_OBJECT (filter, "Can't draw timestamps: video-frame is to narrow");
+  if (!timeoverlay_code_region (mode, frame->info.width, frame->info.height,
+          &region)) {
+    GST_WARNING_OBJECT (filter, "Can't draw timestamps: video-frame is too "
+        "small");
     return GST_FLOW_OK;
   }
 
@@ -223,32 +524,66 @@ gst_timestampoverlay_transform_frame_ip (GstVideoFilter * filter, GstVideoFrame
   else
     render_time = clock_time;
 
-  GST_OBJECT_LOCK (overlay->realtime_clock);
-  render_realtime = gst_clock_unadjust_unlocked (
-      overlay->realtime_clock, render_time);
-  GST_OBJECT_UNLOCK (overlay->realtime_clock);
-
-  imgdata = frame->data[0];
-
-  /* Centre Vertically: */
-  imgdata += (frame->info.height - 6 * 8) * frame->info.stride[0] / 2;
-
-  /* Centre Horizontally: */
-  imgdata += (frame->info.width - 64 * 8) * frame->info.finfo->pixel_stride[0]
-      / 2;
-
-  draw_timestamp (0, buffer_time, imgdata, frame->info.stride[0],
-      frame->info.finfo->pixel_stride[0]);
-  draw_timestamp (1, stream_time, imgdata, frame->info.stride[0],
-      frame->info.finfo->pixel_stride[0]);
-  draw_timestamp (2, running_time, imgdata, frame->info.stride[0],
-      frame->info.finfo->pixel_stride[0]);
-  draw_timestamp (3, clock_time, imgdata, frame->info.stride[0],
-      frame->info.finfo->pixel_stride[0]);
-  draw_timestamp (4, render_time, imgdata, frame->info.stride[0],
-      frame->info.finfo->pixel_stride[0]);
-  draw_timestamp (5, render_realtime, imgdata, frame->info.stride[0],
-      frame->info.finfo->pixel_stride[0]);
+  GST_OBJECT_LOCK (overlay);
+  if (overlay->clock_mapping == GST_TIMESTAMPOVERLAY_CLOCK_MAPPING_CROSS_TIMESTAMP
+      && overlay->n_samples > 0) {
+    GstClockTime last = overlay->samples[overlay->n_samples - 1].clock_time;
+    GstClock *clock = GST_ELEMENT_CLOCK (overlay);
+
+    if (clock && clock_time >= last + GST_TIMESTAMPOVERLAY_SAMPLE_INTERVAL)
+      update_clock_mapping (overlay, clock);
+    render_realtime = map_clock_time_unlocked (overlay, render_time);
+    GST_OBJECT_UNLOCK (overlay);
+  } else {
+    GST_OBJECT_UNLOCK (overlay);
+    GST_OBJECT_LOCK (overlay->realtime_clock);
+    render_realtime = gst_clock_unadjust_unlocked (
+        overlay->realtime_clock, render_time);
+    GST_OBJECT_UNLOCK (overlay->realtime_clock);
+  }
+
+  /* Other formats get the code drawn into a GRAY8 copy of the region, which
+   * is then converted into the frame */
+  native = timeoverlay_format_is_native (GST_VIDEO_FRAME_FORMAT (frame));
+  if (native) {
+    target = frame;
+  } else if (roi_converter_map (&overlay->roi, frame, &region, &roi)) {
+    target = &roi;
+  } else {
+    GST_WARNING_OBJECT (filter, "Can't draw timestamps: no conversion from "
+        "GRAY8 to %s", gst_video_format_to_string (GST_VIDEO_FRAME_FORMAT
+            (frame)));
+    return GST_FLOW_OK;
+  }
+  stride = GST_VIDEO_FRAME_PLANE_STRIDE (target, 0);
+  pxsize = GST_VIDEO_FRAME_COMP_PSTRIDE (target, 0);
+  imgdata = GST_VIDEO_FRAME_PLANE_DATA (target, 0);
+  imgdata += region.y * stride + region.x * pxsize;
+
+  if (mode == GST_TIMEOVERLAY_MODE_VITC) {
+    draw_vitc (render_realtime, sequence, imgdata, stride, pxsize,
+        region.width);
+  } else if (mode == GST_TIMEOVERLAY_MODE_TEMPORAL) {
+    if (sequence % TIMEOVERLAY_TEMPORAL_BITS == 0)
+      timeoverlay_temporal_pack (render_realtime, sequence,
+          overlay->temporal_bits);
+    draw_temporal (overlay->temporal_bits[sequence % TIMEOVERLAY_TEMPORAL_BITS],
+        sequence % TIMEOVERLAY_TEMPORAL_PHASES, imgdata, stride, pxsize,
+        region.width, region.height);
+  } else {
+    draw_timestamp (0, buffer_time, imgdata, stride, pxsize);
+    draw_timestamp (1, stream_time, imgdata, stride, pxsize);
+    draw_timestamp (2, running_time, imgdata, stride, pxsize);
+    draw_timestamp (3, clock_time, imgdata, stride, pxsize);
+    draw_timestamp (4, render_time, imgdata, stride, pxsize);
+    draw_timestamp (5, render_realtime, imgdata, stride, pxsize);
+  }
+
+  if (!native)
+    roi_converter_write (&overlay->roi, &roi, frame);
+
+  TIMEOVERLAY_PROBE_STAMP (mode == GST_TIMEOVERLAY_MODE_BLOCKS ? -1 :
+      (gint64) sequence, clock_time, render_realtime);
 
   return GST_FLOW_OK;
 }
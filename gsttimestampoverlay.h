@@ -23,6 +23,9 @@
 #include <gst/video/video.h>
 #include <gst/video/gstvideofilter.h>
 
+#include "gsttimeoverlaycodec.h"
+#include "roiconvert.h"
+
 G_BEGIN_DECLS
 
 #define GST_TYPE_TIMESTAMPOVERLAY   (gst_timestampoverlay_get_type())
@@ -31,15 +34,49 @@ G_BEGIN_DECLS
 #define GST_IS_TIMESTAMPOVERLAY(obj)   (G_TYPE_CHECK_INSTANCE_TYPE((obj),GST_TYPE_TIMESTAMPOVERLAY))
 #define GST_IS_TIMESTAMPOVERLAY_CLASS(obj)   (G_TYPE_CHECK_CLASS_TYPE((klass),GST_TYPE_TIMESTAMPOVERLAY))
 
+#define GST_TYPE_TIMESTAMPOVERLAY_CLOCK_MAPPING (gst_timestampoverlay_clock_mapping_get_type())
+
 typedef struct _GstTimeStampOverlay GstTimeStampOverlay;
 typedef struct _GstTimeStampOverlayClass GstTimeStampOverlayClass;
 
+typedef enum {
+  GST_TIMESTAMPOVERLAY_CLOCK_MAPPING_SLAVE,
+  GST_TIMESTAMPOVERLAY_CLOCK_MAPPING_CROSS_TIMESTAMP
+} GstTimeStampOverlayClockMapping;
+
+/* Number of (clock, REALTIME) pairs the cross-timestamp mapping is fitted
+ * over.  One is taken per GST_TIMESTAMPOVERLAY_SAMPLE_INTERVAL. */
+#define GST_TIMESTAMPOVERLAY_MAX_CLOCK_SAMPLES 16
+#define GST_TIMESTAMPOVERLAY_SAMPLE_INTERVAL GST_SECOND
+
+typedef struct {
+  GstClockTime clock_time;
+  GstClockTime realtime;
+} GstTimeStampOverlayClockSample;
+
 struct _GstTimeStampOverlay
 {
   GstVideoFilter base_timestampoverlay;
 
   GstClockTime latency;
   GstClock *realtime_clock;
+
+  GstTimeOverlayMode mode;
+  guint32 sequence;
+  /* The temporal mode word being drawn, one bit per frame */
+  guint8 temporal_bits[TIMEOVERLAY_TEMPORAL_BITS];
+  /* For formats we can't draw into directly */
+  RoiConverter roi;
+
+  GstTimeStampOverlayClockMapping clock_mapping;
+
+  /* Cross-timestamp mapping state, protected by the object lock */
+  GstTimeStampOverlayClockSample samples[GST_TIMESTAMPOVERLAY_MAX_CLOCK_SAMPLES];
+  guint n_samples;
+  GstClockTime map_clock_ref;
+  GstClockTime map_realtime_ref;
+  gdouble map_rate;
+  GstClockTime mapping_error;
 };
 
 struct _GstTimeStampOverlayClass
@@ -48,6 +85,7 @@ struct _GstTimeStampOverlayClass
 };
 
 GType gst_timestampoverlay_get_type (void);
+GType gst_timestampoverlay_clock_mapping_get_type (void);
 
 G_END_DECLS
 
@@ -0,0 +1,546 @@
+/* GStreamer
+ * Copyright (C) 2016 William Manley <will@williammanley.net>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "latencyarchive.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FILE_MAGIC "LCARCHV1"
+#define BLOCK_MAGIC "LCBK"
+#define INDEX_MAGIC "LCIX"
+#define FOOTER_MAGIC "LCIXEND1"
+
+/* magic, n_samples, payload_size, then 8 64-bit summary fields */
+#define BLOCK_HEADER_SIZE (4 + 4 + 4 + 8 * 8)
+/* offset, n_samples, payload_size and the summary fields */
+#define INDEX_ENTRY_SIZE (8 + 4 + 4 + 8 * 8)
+/* index offset and magic */
+#define FOOTER_SIZE (8 + 8)
+
+struct _LatencyArchiveWriter
+{
+  FILE *file;
+  guint64 offset;
+  GArray *blocks;
+
+  guint n_samples;
+  gint64 sequences[LATENCY_ARCHIVE_BLOCK_SAMPLES];
+  gint64 times[LATENCY_ARCHIVE_BLOCK_SAMPLES];
+  gint64 latencies[LATENCY_ARCHIVE_BLOCK_SAMPLES];
+};
+
+struct _LatencyArchiveReader
+{
+  FILE *file;
+  GArray *blocks;
+};
+
+/* Encoding helpers */
+
+static void
+put_u32 (GByteArray * buf, guint32 value)
+{
+  value = GUINT32_TO_LE (value);
+  g_byte_array_append (buf, (const guint8 *) &value, 4);
+}
+
+static void
+put_u64 (GByteArray * buf, guint64 value)
+{
+  value = GUINT64_TO_LE (value);
+  g_byte_array_append (buf, (const guint8 *) &value, 8);
+}
+
+static void
+put_varint (GByteArray * buf, gint64 value)
+{
+  /* zigzag so that small negative numbers are small too */
+  guint64 v = ((guint64) value << 1) ^ (guint64) (value >> 63);
+  guint8 byte;
+
+  do {
+    byte = v & 0x7f;
+    v >>= 7;
+    if (v)
+      byte |= 0x80;
+    g_byte_array_append (buf, &byte, 1);
+  } while (v);
+}
+
+/* Reads advance *pos and fail if they'd run past end */
+
+static gboolean
+get_u32 (const guint8 ** pos, const guint8 * end, guint32 * value)
+{
+  if (end - *pos < 4)
+    return FALSE;
+  memcpy (value, *pos, 4);
+  *value = GUINT32_FROM_LE (*value);
+  *pos += 4;
+  return TRUE;
+}
+
+static gboolean
+get_u64 (const guint8 ** pos, const guint8 * end, guint64 * value)
+{
+  if (end - *pos < 8)
+    return FALSE;
+  memcpy (value, *pos, 8);
+  *value = GUINT64_FROM_LE (*value);
+  *pos += 8;
+  return TRUE;
+}
+
+static gboolean
+get_varint (const guint8 ** pos, const guint8 * end, gint64 * value)
+{
+  guint64 v = 0;
+  int shift;
+
+  for (shift = 0; shift < 64; shift += 7) {
+    if (*pos == end)
+      return FALSE;
+    v |= (guint64) (**pos & 0x7f) << shift;
+    if (!(*(*pos)++ & 0x80)) {
+      *value = (gint64) (v >> 1) ^ -(gint64) (v & 1);
+      return TRUE;
+    }
+  }
+  return FALSE;
+}
+
+/* Columns of sequence numbers and times go up by roughly the same amount
+ * every frame, so the delta-of-delta is usually 0 or tiny */
+static void
+put_dod_column (GByteArray * buf, const gint64 * values, guint n)
+{
+  guint64 prev = 0, prev_delta = 0, delta;
+  guint i;
+
+  for (i = 0; i < n; i++) {
+    delta = i ? (guint64) values[i] - prev : 0;
+    put_varint (buf, i ? (gint64) (delta - prev_delta) : values[i]);
+    prev = values[i];
+    prev_delta = delta;
+  }
+}
+
+static gboolean
+get_dod_column (const guint8 ** pos, const guint8 * end, gint64 * values,
+    guint n)
+{
+  guint64 prev = 0, delta = 0;
+  gint64 v;
+  guint i;
+
+  for (i = 0; i < n; i++) {
+    if (!get_varint (pos, end, &v))
+      return FALSE;
+    if (i == 0) {
+      prev = v;
+    } else {
+      delta += v;
+      prev += delta;
+    }
+    values[i] = prev;
+  }
+  return TRUE;
+}
+
+static void
+put_delta_column (GByteArray * buf, const gint64 * values, guint n)
+{
+  guint64 prev = 0;
+  guint i;
+
+  for (i = 0; i < n; i++) {
+    put_varint (buf, (gint64) ((guint64) values[i] - prev));
+    prev = values[i];
+  }
+}
+
+static gboolean
+get_delta_column (const guint8 ** pos, const guint8 * end, gint64 * values,
+    guint n)
+{
+  guint64 prev = 0;
+  gint64 v;
+  guint i;
+
+  for (i = 0; i < n; i++) {
+    if (!get_varint (pos, end, &v))
+      return FALSE;
+    prev += v;
+    values[i] = prev;
+  }
+  return TRUE;
+}
+
+static void
+put_block_summary (GByteArray * buf, const LatencyArchiveBlock * block)
+{
+  put_u64 (buf, block->first_time);
+  put_u64 (buf, block->last_time);
+  put_u64 (buf, block->min_latency);
+  put_u64 (buf, block->max_latency);
+  put_u64 (buf, block->p50_latency);
+  put_u64 (buf, block->p90_latency);
+  put_u64 (buf, block->p99_latency);
+  put_u64 (buf, block->p999_latency);
+}
+
+static gboolean
+get_block_summary (const guint8 ** pos, const guint8 * end,
+    LatencyArchiveBlock * block)
+{
+  return get_u64 (pos, end, (guint64 *) &block->first_time) &&
+      get_u64 (pos, end, (guint64 *) &block->last_time) &&
+      get_u64 (pos, end, (guint64 *) &block->min_latency) &&
+      get_u64 (pos, end, (guint64 *) &block->max_latency) &&
+      get_u64 (pos, end, (guint64 *) &block->p50_latency) &&
+      get_u64 (pos, end, (guint64 *) &block->p90_latency) &&
+      get_u64 (pos, end, (guint64 *) &block->p99_latency) &&
+      get_u64 (pos, end, (guint64 *) &block->p999_latency);
+}
+
+static gboolean
+write_all (FILE * file, const guint8 * data, gsize len, GError ** err)
+{
+  if (fwrite (data, 1, len, file) != len || fflush (file) != 0) {
+    g_set_error (err, G_FILE_ERROR, g_file_error_from_errno (errno),
+        "Failed to write latency archive: %s", g_strerror (errno));
+    return FALSE;
+  }
+  return TRUE;
+}
+
+/* Writer */
+
+static int
+compare_gint64 (const void *a, const void *b)
+{
+  gint64 x = *(const gint64 *) a, y = *(const gint64 *) b;
+  return x < y ? -1 : x > y;
+}
+
+static gint64
+sorted_percentile (const gint64 * sorted, guint n, gdouble percentile)
+{
+  guint rank = (guint) (percentile / 100. * n + 0.5);
+  return sorted[CLAMP (rank, 1, n) - 1];
+}
+
+static gboolean
+flush_block (LatencyArchiveWriter * writer, GError ** err)
+{
+  LatencyArchiveBlock block;
+  GByteArray *payload, *header;
+  gint64 sorted[LATENCY_ARCHIVE_BLOCK_SAMPLES];
+  guint n = writer->n_samples;
+  gboolean ret;
+
+  if (n == 0)
+    return TRUE;
+
+  memcpy (sorted, writer->latencies, n * sizeof (sorted[0]));
+  qsort (sorted, n, sizeof (sorted[0]), compare_gint64);
+
+  payload = g_byte_array_new ();
+  put_dod_column (payload, writer->sequences, n);
+  put_dod_column (payload, writer->times, n);
+  put_delta_column (payload, writer->latencies, n);
+
+  block.offset = writer->offset;
+  block.n_samples = n;
+  block.payload_size = payload->len;
+  block.first_time = writer->times[0];
+  block.last_time = writer->times[n - 1];
+  block.min_latency = sorted[0];
+  block.max_latency = sorted[n - 1];
+  block.p50_latency = sorted_percentile (sorted, n, 50.);
+  block.p90_latency = sorted_percentile (sorted, n, 90.);
+  block.p99_latency = sorted_percentile (sorted, n, 99.);
+  block.p999_latency = sorted_percentile (sorted, n, 99.9);
+
+  header = g_byte_array_new ();
+  g_byte_array_append (header, (const guint8 *) BLOCK_MAGIC, 4);
+  put_u32 (header, block.n_samples);
+  put_u32 (header, block.payload_size);
+  put_block_summary (header, &block);
+
+  ret = write_all (writer->file, header->data, header->len, err) &&
+      write_all (writer->file, payload->data, payload->len, err);
+  if (ret) {
+    writer->offset += header->len + payload->len;
+    g_array_append_val (writer->blocks, block);
+    writer->n_samples = 0;
+  }
+
+  g_byte_array_unref (header);
+  g_byte_array_unref (payload);
+  return ret;
+}
+
+LatencyArchiveWriter *
+latency_archive_writer_new (const gchar * filename, GError ** err)
+{
+  LatencyArchiveWriter *writer;
+  FILE *file;
+
+  file = fopen (filename, "wb");
+  if (!file) {
+    g_set_error (err, G_FILE_ERROR, g_file_error_from_errno (errno),
+        "Failed to create latency archive %s: %s", filename,
+        g_strerror (errno));
+    return NULL;
+  }
+  if (!write_all (file, (const guint8 *) FILE_MAGIC, 8, err)) {
+    fclose (file);
+    return NULL;
+  }
+
+  writer = g_new0 (LatencyArchiveWriter, 1);
+  writer->file = file;
+  writer->offset = 8;
+  writer->blocks = g_array_new (FALSE, FALSE, sizeof (LatencyArchiveBlock));
+  return writer;
+}
+
+gboolean
+latency_archive_writer_append (LatencyArchiveWriter * writer,
+    gint64 sequence, gint64 time, gint64 latency, GError ** err)
+{
+  writer->sequences[writer->n_samples] = sequence;
+  writer->times[writer->n_samples] = time;
+  writer->latencies[writer->n_samples] = latency;
+
+  if (++writer->n_samples == LATENCY_ARCHIVE_BLOCK_SAMPLES)
+    return flush_block (writer, err);
+  return TRUE;
+}
+
+gboolean
+latency_archive_writer_close (LatencyArchiveWriter * writer, GError ** err)
+{
+  LatencyArchiveBlock *block;
+  GByteArray *index;
+  gboolean ret;
+  guint n;
+
+  ret = flush_block (writer, err);
+
+  if (ret) {
+    index = g_byte_array_new ();
+    g_byte_array_append (index, (const guint8 *) INDEX_MAGIC, 4);
+    put_u32 (index, writer->blocks->len);
+    for (n = 0; n < writer->blocks->len; n++) {
+      block = &g_array_index (writer->blocks, LatencyArchiveBlock, n);
+      put_u64 (index, block->offset);
+      put_u32 (index, block->n_samples);
+      put_u32 (index, block->payload_size);
+      put_block_summary (index, block);
+    }
+    put_u64 (index, writer->offset);
+    g_byte_array_append (index, (const guint8 *) FOOTER_MAGIC, 8);
+    ret = write_all (writer->file, index->data, index->len, err);
+    g_byte_array_unref (index);
+  }
+
+  fclose (writer->file);
+  g_array_unref (writer->blocks);
+  g_free (writer);
+  return ret;
+}
+
+/* Reader */
+
+static gboolean
+read_at (FILE * file, guint64 offset, guint8 * data, gsize len)
+{
+  return fseeko (file, offset, SEEK_SET) == 0 &&
+      fread (data, 1, len, file) == len;
+}
+
+static gboolean
+read_index (LatencyArchiveReader * reader, guint64 file_size)
+{
+  guint8 footer[FOOTER_SIZE], head[8];
+  const guint8 *pos, *end;
+  guint64 index_offset;
+  guint32 n_blocks, n;
+  LatencyArchiveBlock block;
+  guint8 *index;
+  gboolean ret = TRUE;
+
+  if (file_size < 8 + 8 + FOOTER_SIZE ||
+      !read_at (reader->file, file_size - FOOTER_SIZE, footer, FOOTER_SIZE) ||
+      memcmp (footer + 8, FOOTER_MAGIC, 8) != 0)
+    return FALSE;
+
+  pos = footer;
+  get_u64 (&pos, footer + 8, &index_offset);
+  if (index_offset > file_size - FOOTER_SIZE - 8 ||
+      !read_at (reader->file, index_offset, head, 8) ||
+      memcmp (head, INDEX_MAGIC, 4) != 0)
+    return FALSE;
+
+  pos = head + 4;
+  get_u32 (&pos, head + 8, &n_blocks);
+  if ((guint64) n_blocks * INDEX_ENTRY_SIZE !=
+      file_size - FOOTER_SIZE - index_offset - 8)
+    return FALSE;
+
+  index = g_malloc ((gsize) n_blocks * INDEX_ENTRY_SIZE);
+  if (!read_at (reader->file, index_offset + 8, index,
+          (gsize) n_blocks * INDEX_ENTRY_SIZE)) {
+    g_free (index);
+    return FALSE;
+  }
+
+  pos = index;
+  end = index + (gsize) n_blocks * INDEX_ENTRY_SIZE;
+  for (n = 0; n < n_blocks && ret; n++) {
+    ret = get_u64 (&pos, end, &block.offset) &&
+        get_u32 (&pos, end, &block.n_samples) &&
+        get_u32 (&pos, end, &block.payload_size) &&
+        get_block_summary (&pos, end, &block);
+    if (ret)
+      g_array_append_val (reader->blocks, block);
+  }
+  g_free (index);
+
+  if (!ret)
+    g_array_set_size (reader->blocks, 0);
+  return ret;
+}
+
+/* For archives whose writer didn't get to close them.  A partially written
+ * last block is ignored. */
+static void
+scan_blocks (LatencyArchiveReader * reader, guint64 file_size)
+{
+  guint8 header[BLOCK_HEADER_SIZE];
+  const guint8 *pos;
+  LatencyArchiveBlock block;
+  guint64 offset = 8;
+
+  while (offset + BLOCK_HEADER_SIZE <= file_size &&
+      read_at (reader->file, offset, header, BLOCK_HEADER_SIZE) &&
+      memcmp (header, BLOCK_MAGIC, 4) == 0) {
+    pos = header + 4;
+    block.offset = offset;
+    get_u32 (&pos, header + BLOCK_HEADER_SIZE, &block.n_samples);
+    get_u32 (&pos, header + BLOCK_HEADER_SIZE, &block.payload_size);
+    get_block_summary (&pos, header + BLOCK_HEADER_SIZE, &block);
+
+    offset += BLOCK_HEADER_SIZE + block.payload_size;
+    if (offset > file_size || block.n_samples > LATENCY_ARCHIVE_BLOCK_SAMPLES)
+      break;
+    g_array_append_val (reader->blocks, block);
+  }
+}
+
+LatencyArchiveReader *
+latency_archive_reader_new (const gchar * filename, GError ** err)
+{
+  LatencyArchiveReader *reader;
+  guint8 magic[8];
+  guint64 file_size;
+  FILE *file;
+
+  file = fopen (filename, "rb");
+  if (!file) {
+    g_set_error (err, G_FILE_ERROR, g_file_error_from_errno (errno),
+        "Failed to open latency archive %s: %s", filename,
+        g_strerror (errno));
+    return NULL;
+  }
+
+  if (!read_at (file, 0, magic, 8) || memcmp (magic, FILE_MAGIC, 8) != 0 ||
+      fseeko (file, 0, SEEK_END) != 0) {
+    g_set_error (err, G_FILE_ERROR, G_FILE_ERROR_FAILED,
+        "%s is not a latency archive", filename);
+    fclose (file);
+    return NULL;
+  }
+  file_size = ftello (file);
+
+  reader = g_new0 (LatencyArchiveReader, 1);
+  reader->file = file;
+  reader->blocks = g_array_new (FALSE, FALSE, sizeof (LatencyArchiveBlock));
+  if (!read_index (reader, file_size))
+    scan_blocks (reader, file_size);
+  return reader;
+}
+
+void
+latency_archive_reader_free (LatencyArchiveReader * reader)
+{
+  fclose (reader->file);
+  g_array_unref (reader->blocks);
+  g_free (reader);
+}
+
+guint
+latency_archive_reader_n_blocks (LatencyArchiveReader * reader)
+{
+  return reader->blocks->len;
+}
+
+const LatencyArchiveBlock *
+latency_archive_reader_get_block (LatencyArchiveReader * reader, guint n)
+{
+  g_return_val_if_fail (n < reader->blocks->len, NULL);
+  return &g_array_index (reader->blocks, LatencyArchiveBlock, n);
+}
+
+gboolean
+latency_archive_reader_read_block (LatencyArchiveReader * reader, guint n,
+    gint64 * sequences, gint64 * times, gint64 * latencies, GError ** err)
+{
+  const LatencyArchiveBlock *block;
+  const guint8 *pos, *end;
+  guint8 *payload;
+  gboolean ret;
+
+  block = latency_archive_reader_get_block (reader, n);
+  g_return_val_if_fail (block != NULL, FALSE);
+
+  payload = g_malloc (block->payload_size);
+  pos = payload;
+  end = payload + block->payload_size;
+  ret = read_at (reader->file, block->offset + BLOCK_HEADER_SIZE, payload,
+      block->payload_size) &&
+      get_dod_column (&pos, end, sequences, block->n_samples) &&
+      get_dod_column (&pos, end, times, block->n_samples) &&
+      get_delta_column (&pos, end, latencies, block->n_samples);
+  g_free (payload);
+
+  if (!ret)
+    g_set_error (err, G_FILE_ERROR, G_FILE_ERROR_FAILED,
+        "Latency archive block %u is corrupt", n);
+  return ret;
+}
@@ -0,0 +1,81 @@
+/* GStreamer
+ * Copyright (C) 2016 William Manley <will@williammanley.net>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef _LATENCYARCHIVE_H_
+#define _LATENCYARCHIVE_H_
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Compact archive of latency samples for long runs.
+ *
+ * Samples are stored in blocks of up to LATENCY_ARCHIVE_BLOCK_SAMPLES.  Each
+ * block starts with a header giving its time range and a summary of the
+ * latencies in it (min, max, p50, p90, p99, p99.9), followed by three
+ * columns: sequence numbers and capture times as zigzag varints of their
+ * delta-of-delta, and latencies as zigzag varints of their delta.  Closing
+ * the archive appends an index of block offsets and time ranges so a reader
+ * can go straight to the blocks covering a time range.  If the writer never
+ * closed the archive the reader rebuilds the index by skipping from block
+ * header to block header.
+ *
+ * All integers in headers are little-endian. */
+#define LATENCY_ARCHIVE_BLOCK_SAMPLES 4096
+
+typedef struct {
+  guint64 offset;
+  guint32 n_samples;
+  guint32 payload_size;
+  gint64 first_time;
+  gint64 last_time;
+  gint64 min_latency;
+  gint64 max_latency;
+  gint64 p50_latency;
+  gint64 p90_latency;
+  gint64 p99_latency;
+  gint64 p999_latency;
+} LatencyArchiveBlock;
+
+typedef struct _LatencyArchiveWriter LatencyArchiveWriter;
+typedef struct _LatencyArchiveReader LatencyArchiveReader;
+
+LatencyArchiveWriter *latency_archive_writer_new (const gchar * filename,
+    GError ** err);
+/* sequence is -1 if unknown, time is when the frame was captured */
+gboolean latency_archive_writer_append (LatencyArchiveWriter * writer,
+    gint64 sequence, gint64 time, gint64 latency, GError ** err);
+/* Writes out the last partial block and the index and frees the writer */
+gboolean latency_archive_writer_close (LatencyArchiveWriter * writer,
+    GError ** err);
+
+LatencyArchiveReader *latency_archive_reader_new (const gchar * filename,
+    GError ** err);
+void latency_archive_reader_free (LatencyArchiveReader * reader);
+guint latency_archive_reader_n_blocks (LatencyArchiveReader * reader);
+const LatencyArchiveBlock *latency_archive_reader_get_block (
+    LatencyArchiveReader * reader, guint n);
+/* Decodes block n into arrays of block->n_samples entries each */
+gboolean latency_archive_reader_read_block (LatencyArchiveReader * reader,
+    guint n, gint64 * sequences, gint64 * times, gint64 * latencies,
+    GError ** err);
+
+G_END_DECLS
+
+#endif
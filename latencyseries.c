@@ -0,0 +1,299 @@
+/* GStreamer
+ * Copyright (C) 2016 William Manley <will@williammanley.net>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "latencyseries.h"
+
+#include <errno.h>
+#include <stdio.h>
+
+/* A longer gap between frames, e.g. from the clock being stepped or a
+ * misread timestamp, is marked with a single empty row and the series
+ * starts again from the new time */
+#define MAX_EMPTY_ROWS 1000
+
+typedef struct {
+  gint64 time;
+  gint64 latency;
+} SeriesPoint;
+
+/* The frames of one interval.  There is always at least one point, undecoded
+ * frames are counted in the interval of the last frame decoded. */
+typedef struct {
+  gint64 index;
+  LatencyHistogram *hist;
+  GArray *points;
+  guint undecoded;
+  guint64 dropped;
+} SeriesBucket;
+
+struct _LatencySeries
+{
+  FILE *file;
+  gint64 interval;
+
+  /* The interval frames are being added to, and the one before it which is
+   * waiting for it to finish so its representative frame can be picked */
+  SeriesBucket buckets[2];
+  SeriesBucket *current;
+  SeriesBucket *pending;
+
+  /* Representative frame of the last row written */
+  gboolean have_selected;
+  SeriesPoint selected;
+};
+
+static void
+bucket_init (SeriesBucket * bucket)
+{
+  bucket->hist = latency_histogram_new ();
+  bucket->points = g_array_new (FALSE, FALSE, sizeof (SeriesPoint));
+}
+
+static void
+bucket_clear (SeriesBucket * bucket, gint64 index)
+{
+  bucket->index = index;
+  latency_histogram_reset (bucket->hist);
+  g_array_set_size (bucket->points, 0);
+  bucket->undecoded = 0;
+  bucket->dropped = 0;
+}
+
+static void
+bucket_free (SeriesBucket * bucket)
+{
+  latency_histogram_free (bucket->hist);
+  g_array_unref (bucket->points);
+}
+
+static SeriesPoint
+bucket_mean (const SeriesBucket * bucket)
+{
+  SeriesPoint mean;
+  gdouble t = 0, l = 0;
+  guint n;
+
+  /* Relative to the first point to keep the precision */
+  mean = g_array_index (bucket->points, SeriesPoint, 0);
+  for (n = 0; n < bucket->points->len; n++) {
+    t += g_array_index (bucket->points, SeriesPoint, n).time - mean.time;
+    l += g_array_index (bucket->points, SeriesPoint, n).latency - mean.latency;
+  }
+  mean.time += t / bucket->points->len;
+  mean.latency += l / bucket->points->len;
+  return mean;
+}
+
+/* The point of bucket with the largest triangle between a and c */
+static SeriesPoint
+bucket_select (const SeriesBucket * bucket, SeriesPoint a, SeriesPoint c)
+{
+  const SeriesPoint *p;
+  gdouble area, best_area = -1, ct, cl;
+  guint n, best = 0;
+
+  ct = (c.time - a.time) / 1e9;
+  cl = (c.latency - a.latency) / 1e6;
+  for (n = 0; n < bucket->points->len; n++) {
+    p = &g_array_index (bucket->points, SeriesPoint, n);
+    area = ABS (ct * ((p->latency - a.latency) / 1e6) -
+        ((p->time - a.time) / 1e9) * cl);
+    if (area > best_area) {
+      best_area = area;
+      best = n;
+    }
+  }
+  return g_array_index (bucket->points, SeriesPoint, best);
+}
+
+static gboolean
+write_row (LatencySeries * series, gint64 index, const SeriesBucket * bucket,
+    const SeriesPoint * selected, GError ** err)
+{
+  const LatencyHistogram *hist = bucket ? bucket->hist : NULL;
+
+  fprintf (series->file, "%.3f,%" G_GUINT64_FORMAT ",%u,%" G_GUINT64_FORMAT,
+      index * series->interval / 1e9, hist ? hist->count : 0,
+      bucket ? bucket->undecoded : 0, bucket ? bucket->dropped : 0);
+  if (hist && hist->count)
+    fprintf (series->file, ",%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f\n",
+        hist->min / 1e6, hist->sum / hist->count / 1e6,
+        latency_histogram_percentile (hist, 50.) / 1e6,
+        latency_histogram_percentile (hist, 90.) / 1e6,
+        latency_histogram_percentile (hist, 99.) / 1e6,
+        latency_histogram_percentile (hist, 99.9) / 1e6,
+        hist->max / 1e6, selected->time / 1e9, selected->latency / 1e6);
+  else
+    fprintf (series->file, ",,,,,,,,,\n");
+
+  if (fflush (series->file) != 0 || ferror (series->file)) {
+    g_set_error (err, G_FILE_ERROR, g_file_error_from_errno (errno),
+        "Failed to write latency time series: %s", g_strerror (errno));
+    return FALSE;
+  }
+  return TRUE;
+}
+
+/* Writes the pending row, given the mean of the interval after it, and any
+ * empty rows between the two.  latency_series_record keeps those to at most
+ * MAX_EMPTY_ROWS. */
+static gboolean
+write_pending (LatencySeries * series, const SeriesPoint * next,
+    gint64 next_index, GError ** err)
+{
+  SeriesBucket *pending = series->pending;
+  gint64 index;
+
+  if (pending->points->len > 0) {
+    if (!series->have_selected)
+      series->selected = g_array_index (pending->points, SeriesPoint, 0);
+    series->selected = bucket_select (pending, series->selected, *next);
+    series->have_selected = TRUE;
+  }
+  if (!write_row (series, pending->index, pending, &series->selected, err))
+    return FALSE;
+
+  for (index = pending->index + 1; index < next_index; index++)
+    if (!write_row (series, index, NULL, NULL, err))
+      return FALSE;
+
+  series->pending = NULL;
+  return TRUE;
+}
+
+static gboolean
+finish_current (LatencySeries * series, GError ** err)
+{
+  SeriesBucket *current = series->current;
+  SeriesPoint mean;
+
+  if (series->pending) {
+    mean = bucket_mean (current);
+    if (!write_pending (series, &mean, current->index, err))
+      return FALSE;
+  }
+  series->pending = current;
+  series->current = NULL;
+  return TRUE;
+}
+
+LatencySeries *
+latency_series_new (const gchar * filename, gint64 interval, GError ** err)
+{
+  LatencySeries *series;
+  FILE *file;
+
+  g_return_val_if_fail (interval > 0, NULL);
+
+  file = fopen (filename, "w");
+  if (!file) {
+    g_set_error (err, G_FILE_ERROR, g_file_error_from_errno (errno),
+        "Failed to create %s: %s", filename, g_strerror (errno));
+    return NULL;
+  }
+  fprintf (file, "time,frames,undecoded,dropped,min,mean,p50,p90,p99,p99.9,"
+      "max,frame-time,frame-latency\n");
+
+  series = g_new0 (LatencySeries, 1);
+  series->file = file;
+  series->interval = interval;
+  bucket_init (&series->buckets[0]);
+  bucket_init (&series->buckets[1]);
+  return series;
+}
+
+/* Writes out every row so far, the last one keeping its last frame as LTTB
+ * does */
+static gboolean
+flush_rows (LatencySeries * series, GError ** err)
+{
+  SeriesPoint last;
+
+  if (series->current && !finish_current (series, err))
+    return FALSE;
+  if (!series->pending)
+    return TRUE;
+  last = g_array_index (series->pending->points, SeriesPoint,
+      series->pending->points->len - 1);
+  return write_pending (series, &last, series->pending->index + 1, err);
+}
+
+static SeriesBucket *
+free_bucket (LatencySeries * series)
+{
+  return series->pending == &series->buckets[0] ?
+      &series->buckets[1] : &series->buckets[0];
+}
+
+gboolean
+latency_series_record (LatencySeries * series, gint64 time, gint64 latency,
+    guint64 dropped, GError ** err)
+{
+  gint64 index = time / series->interval;
+  SeriesPoint point = { time, latency };
+  SeriesBucket *current;
+  gint64 last_index;
+
+  if (series->current && ABS (index - series->current->index) >
+      MAX_EMPTY_ROWS) {
+    last_index = series->current->index;
+    if (!flush_rows (series, err) ||
+        !write_row (series, last_index + 1, NULL, NULL, err))
+      return FALSE;
+    series->have_selected = FALSE;
+  } else if (series->current && index > series->current->index) {
+    if (!finish_current (series, err))
+      return FALSE;
+  }
+  if (!series->current) {
+    series->current = free_bucket (series);
+    bucket_clear (series->current, index);
+  }
+  current = series->current;
+
+  /* Frames from before the current interval are counted in it */
+  latency_histogram_record (current->hist, latency);
+  g_array_append_val (current->points, point);
+  current->dropped += dropped;
+  return TRUE;
+}
+
+void
+latency_series_record_undecoded (LatencySeries * series)
+{
+  if (series->current)
+    series->current->undecoded++;
+}
+
+gboolean
+latency_series_close (LatencySeries * series, GError ** err)
+{
+  gboolean ret = flush_rows (series, err);
+
+  fclose (series->file);
+  bucket_free (&series->buckets[0]);
+  bucket_free (&series->buckets[1]);
+  g_free (series);
+  return ret;
+}
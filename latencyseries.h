@@ -0,0 +1,51 @@
+/* GStreamer
+ * Copyright (C) 2016 William Manley <will@williammanley.net>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef _LATENCYSERIES_H_
+#define _LATENCYSERIES_H_
+
+#include "latencystats.h"
+
+G_BEGIN_DECLS
+
+/* Fixed-size time series of latency for plotting long runs, written to CSV
+ * in a single streaming pass.  Each row covers one interval of capture time
+ * and gives the number of frames decoded, not decoded and dropped (lost
+ * before reaching the capture), the min/mean/p50/p90/p99/p99.9/max latency and one
+ * representative frame chosen Largest-Triangle-Three-Buckets style: the one
+ * making the largest triangle with the previous row's frame and the mean of
+ * the next interval.  Rows are therefore written one interval late.
+ * Latencies are in milliseconds and times in seconds since the epoch.  A
+ * jump of more than 1000 intervals between frames gets one empty row
+ * instead of an empty row for every interval. */
+typedef struct _LatencySeries LatencySeries;
+
+LatencySeries *latency_series_new (const gchar * filename, gint64 interval,
+    GError ** err);
+/* dropped is the number of frames lost just before this one, as worked out
+ * by whoever knows the server's and the capture's frame rates */
+gboolean latency_series_record (LatencySeries * series, gint64 time,
+    gint64 latency, guint64 dropped, GError ** err);
+void latency_series_record_undecoded (LatencySeries * series);
+/* Writes out the last rows and frees the series */
+gboolean latency_series_close (LatencySeries * series, GError ** err);
+
+G_END_DECLS
+
+#endif
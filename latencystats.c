@@ -0,0 +1,178 @@
+/* GStreamer
+ * Copyright (C) 2016 William Manley <will@williammanley.net>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "latencystats.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+
+static guint
+bucket_index (gint64 value)
+{
+  guint64 v = value > 0 ? value : 0;
+  int shift;
+
+  if (v < 128)
+    return v;
+
+  shift = (63 - __builtin_clzll (v)) - 6;
+  return 128 + (shift - 1) * 64 + ((v >> shift) - 64);
+}
+
+/* The middle of the range of values that fall into bucket n */
+static gint64
+bucket_value (guint n)
+{
+  int shift;
+
+  if (n < 128)
+    return n;
+
+  shift = (n - 128) / 64 + 1;
+  return ((guint64) ((n - 128) % 64 + 64) << shift) + ((guint64) 1 << shift) / 2;
+}
+
+LatencyHistogram *
+latency_histogram_new (void)
+{
+  LatencyHistogram *hist;
+
+  hist = mmap (NULL, sizeof (*hist), PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (hist == MAP_FAILED)
+    g_error ("Failed to allocate latency histogram: %s", g_strerror (errno));
+
+  /* The counts are already zero, only touch the first page */
+  hist->min = G_MAXINT64;
+  hist->max = G_MININT64;
+  return hist;
+}
+
+void
+latency_histogram_free (LatencyHistogram * hist)
+{
+  if (hist)
+    munmap (hist, sizeof (*hist));
+}
+
+void
+latency_histogram_reset (LatencyHistogram * hist)
+{
+  memset (hist, 0, sizeof (*hist));
+  hist->min = G_MAXINT64;
+  hist->max = G_MININT64;
+}
+
+void
+latency_histogram_record (LatencyHistogram * hist, gint64 value)
+{
+  hist->counts[bucket_index (value)]++;
+  hist->count++;
+  hist->sum += value;
+  if (value < hist->min)
+    hist->min = value;
+  if (value > hist->max)
+    hist->max = value;
+}
+
+void
+latency_histogram_record_corrected (LatencyHistogram * hist, gint64 value,
+    guint64 missing, gint64 interval)
+{
+  guint64 n;
+
+  latency_histogram_record (hist, value);
+  for (n = 1; n <= missing; n++)
+    latency_histogram_record (hist, value + n * interval);
+}
+
+void
+latency_histogram_merge (LatencyHistogram * dest, const LatencyHistogram * src)
+{
+  guint n;
+
+  for (n = 0; n < LATENCY_HISTOGRAM_BUCKETS; n++)
+    dest->counts[n] += src->counts[n];
+  dest->count += src->count;
+  dest->sum += src->sum;
+  dest->min = MIN (dest->min, src->min);
+  dest->max = MAX (dest->max, src->max);
+}
+
+gint64
+latency_histogram_percentile (const LatencyHistogram * hist, gdouble percentile)
+{
+  guint64 rank, seen = 0;
+  guint n;
+
+  if (hist->count == 0)
+    return 0;
+
+  rank = MAX (1, (guint64) (percentile / 100. * hist->count + 0.5));
+  for (n = 0; n < LATENCY_HISTOGRAM_BUCKETS; n++) {
+    seen += hist->counts[n];
+    if (seen >= rank)
+      return CLAMP (bucket_value (n), hist->min, hist->max);
+  }
+  return hist->max;
+}
+
+void
+latency_histogram_to_structure (const LatencyHistogram * hist,
+    GstStructure * s, const gchar * prefix)
+{
+  static const struct {
+    const gchar *name;
+    gdouble percentile;
+  } percentiles[] = {
+    {"p50", 50.}, {"p90", 90.}, {"p99", 99.}, {"p99.9", 99.9}
+  };
+  gchar *name;
+  guint n;
+
+  name = g_strdup_printf ("%s-count", prefix);
+  gst_structure_set (s, name, G_TYPE_UINT64, hist->count, NULL);
+  g_free (name);
+
+  if (hist->count == 0)
+    return;
+
+  name = g_strdup_printf ("%s-min", prefix);
+  gst_structure_set (s, name, G_TYPE_INT64, hist->min, NULL);
+  g_free (name);
+  name = g_strdup_printf ("%s-max", prefix);
+  gst_structure_set (s, name, G_TYPE_INT64, hist->max, NULL);
+  g_free (name);
+  name = g_strdup_printf ("%s-mean", prefix);
+  gst_structure_set (s, name, G_TYPE_INT64,
+      (gint64) (hist->sum / hist->count), NULL);
+  g_free (name);
+
+  for (n = 0; n < G_N_ELEMENTS (percentiles); n++) {
+    name = g_strdup_printf ("%s-%s", prefix, percentiles[n].name);
+    gst_structure_set (s, name, G_TYPE_INT64,
+        latency_histogram_percentile (hist, percentiles[n].percentile), NULL);
+    g_free (name);
+  }
+}
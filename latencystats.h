@@ -0,0 +1,67 @@
+/* GStreamer
+ * Copyright (C) 2016 William Manley <will@williammanley.net>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef _LATENCYSTATS_H_
+#define _LATENCYSTATS_H_
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/* Log-linear histogram of nanosecond values in the style of HdrHistogram.
+ * Values below 128 ns get a bucket each, above that every power of two is
+ * split into 64 buckets, so any value is known to within 1.6%.  Negative
+ * values (which can happen if the clocks are out of sync) are counted in
+ * the first bucket but still reflected in min and mean. */
+#define LATENCY_HISTOGRAM_BUCKETS (128 + 56 * 64)
+
+typedef struct {
+  guint64 count;
+  gint64 min;
+  gint64 max;
+  gdouble sum;
+  guint64 counts[LATENCY_HISTOGRAM_BUCKETS];
+} LatencyHistogram;
+
+/* Histograms are allocated with mmap, so their pages are only placed (on
+ * the NUMA node of the thread) when a value is first recorded into them */
+LatencyHistogram *latency_histogram_new (void);
+void latency_histogram_free (LatencyHistogram * hist);
+
+void latency_histogram_reset (LatencyHistogram * hist);
+void latency_histogram_record (LatencyHistogram * hist, gint64 value);
+/* Corrects for coordinated omission: frames lost while the device under
+ * test stalled would otherwise be missing from the tail.  Records value,
+ * then value + n * interval for n from 1 to missing, which is the least
+ * latency the missing frames before this one could have had. */
+void latency_histogram_record_corrected (LatencyHistogram * hist,
+    gint64 value, guint64 missing, gint64 interval);
+void latency_histogram_merge (LatencyHistogram * dest,
+    const LatencyHistogram * src);
+gint64 latency_histogram_percentile (const LatencyHistogram * hist,
+    gdouble percentile);
+
+/* Adds count, min, max, mean, p50, p90, p99 and p99.9 fields named with the
+ * given prefix, e.g. "latency-p99" */
+void latency_histogram_to_structure (const LatencyHistogram * hist,
+    GstStructure * s, const gchar * prefix);
+
+G_END_DECLS
+
+#endif
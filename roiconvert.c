@@ -0,0 +1,257 @@
+/* GStreamer
+ * Copyright (C) 2016 William Manley <will@williammanley.net>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "roiconvert.h"
+
+gboolean
+timeoverlay_format_is_native (GstVideoFormat format)
+{
+  switch (format) {
+    case GST_VIDEO_FORMAT_RGB:
+    case GST_VIDEO_FORMAT_BGR:
+    case GST_VIDEO_FORMAT_BGRx:
+    case GST_VIDEO_FORMAT_xBGR:
+    case GST_VIDEO_FORMAT_RGBx:
+    case GST_VIDEO_FORMAT_xRGB:
+    case GST_VIDEO_FORMAT_RGB15:
+    case GST_VIDEO_FORMAT_RGB16:
+    case GST_VIDEO_FORMAT_YUY2:
+    case GST_VIDEO_FORMAT_GRAY8:
+      return TRUE;
+    default:
+      return FALSE;
+  }
+}
+
+/* Whether gst_video_converter can convert part of a frame of the format.
+ * Tiled formats can only be unpacked a whole tile at a time. */
+static gboolean
+format_is_convertible (GstVideoFormat format)
+{
+  const GstVideoFormatInfo *finfo = gst_video_format_get_info (format);
+
+  return finfo && !GST_VIDEO_FORMAT_INFO_IS_TILED (finfo) &&
+      finfo->unpack_func && finfo->pack_func;
+}
+
+GstCaps *
+timeoverlay_video_caps (void)
+{
+  GstCaps *caps, *other;
+  GstStructure *s;
+  const GValue *all, *value;
+  GValue formats = G_VALUE_INIT;
+  GstVideoFormat format;
+  guint n;
+
+  caps = gst_caps_from_string (GST_VIDEO_CAPS_MAKE (TIMEOVERLAY_NATIVE_FORMATS));
+  other = gst_caps_from_string (GST_VIDEO_CAPS_MAKE (GST_VIDEO_FORMATS_ALL));
+  s = gst_caps_get_structure (other, 0);
+  all = gst_structure_get_value (s, "format");
+
+  g_value_init (&formats, GST_TYPE_LIST);
+  for (n = 0; n < gst_value_list_get_size (all); n++) {
+    value = gst_value_list_get_value (all, n);
+    format = gst_video_format_from_string (g_value_get_string (value));
+    if (!timeoverlay_format_is_native (format) &&
+        format_is_convertible (format))
+      gst_value_list_append_value (&formats, value);
+  }
+  gst_structure_take_value (s, "format", &formats);
+
+  gst_caps_append (caps, other);
+  return caps;
+}
+
+void
+roi_converter_clear (RoiConverter * conv)
+{
+  if (conv->from_frame)
+    gst_video_converter_free (conv->from_frame);
+  if (conv->to_frame)
+    gst_video_converter_free (conv->to_frame);
+  conv->from_frame = conv->to_frame = NULL;
+  gst_buffer_replace (&conv->roi_buffer, NULL);
+}
+
+static gboolean
+region_equal (const TimeOverlayRegion * a, const TimeOverlayRegion * b)
+{
+  return a->x == b->x && a->y == b->y && a->width == b->width &&
+      a->height == b->height;
+}
+
+/* Grows region to whole chroma samples and, for formats that pack several
+ * pixels into a word, whole words, keeping it inside the frame */
+static void
+align_region (const GstVideoInfo * info, const TimeOverlayRegion * region,
+    TimeOverlayRegion * area)
+{
+  const GstVideoFormatInfo *finfo = info->finfo;
+  gint x_align = 1, y_align = MAX (finfo->pack_lines, 1);
+  gint c, right, bottom;
+
+  for (c = 0; c < GST_VIDEO_FORMAT_INFO_N_COMPONENTS (finfo); c++) {
+    x_align = MAX (x_align, 1 << GST_VIDEO_FORMAT_INFO_W_SUB (finfo, c));
+    y_align = MAX (y_align, 1 << GST_VIDEO_FORMAT_INFO_H_SUB (finfo, c));
+  }
+  switch (GST_VIDEO_INFO_FORMAT (info)) {
+    case GST_VIDEO_FORMAT_v210:
+#if GST_CHECK_VERSION(1, 14, 0)
+    case GST_VIDEO_FORMAT_NV12_10LE32:
+#endif
+#if GST_CHECK_VERSION(1, 16, 0)
+    case GST_VIDEO_FORMAT_NV16_10LE32:
+#endif
+      /* 3 components in each 32-bit word */
+      x_align = 6;
+      break;
+#if GST_CHECK_VERSION(1, 16, 0)
+    case GST_VIDEO_FORMAT_NV12_10LE40:
+      /* 4 components in each 5 bytes */
+      x_align = 4;
+      break;
+#endif
+    default:
+      break;
+  }
+
+  area->x = region->x / x_align * x_align;
+  area->y = region->y / y_align * y_align;
+  right = MIN (GST_VIDEO_INFO_WIDTH (info),
+      (region->x + region->width + x_align - 1) / x_align * x_align);
+  bottom = MIN (GST_VIDEO_INFO_HEIGHT (info),
+      (region->y + region->height + y_align - 1) / y_align * y_align);
+  area->width = right - area->x;
+  area->height = bottom - area->y;
+}
+
+/* Converts the rectangle src of in_info to the rectangle dest of out_info */
+static GstVideoConverter *
+new_converter (const GstVideoInfo * in_info, const TimeOverlayRegion * src,
+    const GstVideoInfo * out_info, const TimeOverlayRegion * dest)
+{
+  /* Only the region is touched, and the code is black, white and grey, so
+   * there's nothing to gain from dithering */
+  return gst_video_converter_new ((GstVideoInfo *) in_info,
+      (GstVideoInfo *) out_info, gst_structure_new ("GstVideoConverter",
+          GST_VIDEO_CONVERTER_OPT_SRC_X, G_TYPE_INT, src->x,
+          GST_VIDEO_CONVERTER_OPT_SRC_Y, G_TYPE_INT, src->y,
+          GST_VIDEO_CONVERTER_OPT_SRC_WIDTH, G_TYPE_INT, src->width,
+          GST_VIDEO_CONVERTER_OPT_SRC_HEIGHT, G_TYPE_INT, src->height,
+          GST_VIDEO_CONVERTER_OPT_DEST_X, G_TYPE_INT, dest->x,
+          GST_VIDEO_CONVERTER_OPT_DEST_Y, G_TYPE_INT, dest->y,
+          GST_VIDEO_CONVERTER_OPT_DEST_WIDTH, G_TYPE_INT, dest->width,
+          GST_VIDEO_CONVERTER_OPT_DEST_HEIGHT, G_TYPE_INT, dest->height,
+          GST_VIDEO_CONVERTER_OPT_FILL_BORDER, G_TYPE_BOOLEAN, FALSE,
+          GST_VIDEO_CONVERTER_OPT_DITHER_METHOD, GST_TYPE_VIDEO_DITHER_METHOD,
+          GST_VIDEO_DITHER_NONE, NULL));
+}
+
+static gboolean
+ensure_converter (RoiConverter * conv, const GstVideoInfo * info,
+    const TimeOverlayRegion * region, gboolean drawing)
+{
+  TimeOverlayRegion roi;
+
+  if (conv->roi_buffer && conv->drawing == drawing &&
+      region_equal (&conv->region, region) &&
+      gst_video_info_is_equal (&conv->frame_info, info))
+    return TRUE;
+
+  roi_converter_clear (conv);
+  conv->frame_info = *info;
+  conv->region = *region;
+  conv->drawing = drawing;
+  align_region (info, region, &conv->area);
+  roi.x = roi.y = 0;
+  roi.width = conv->area.width;
+  roi.height = conv->area.height;
+  gst_video_info_set_format (&conv->roi_info, GST_VIDEO_FORMAT_GRAY8,
+      roi.width, roi.height);
+
+  /* When drawing, the pixels that the area adds around the code are read
+   * first so that they are written back as they were */
+  if (!drawing || !region_equal (&conv->area, region)) {
+    conv->from_frame = new_converter (info, &conv->area, &conv->roi_info,
+        &roi);
+    if (!conv->from_frame)
+      return FALSE;
+  }
+  if (drawing) {
+    conv->to_frame = new_converter (&conv->roi_info, &roi, info,
+        &conv->area);
+    if (!conv->to_frame)
+      return FALSE;
+  }
+
+  conv->roi_buffer = gst_buffer_new_allocate (NULL, conv->roi_info.size, NULL);
+  return TRUE;
+}
+
+/* Maps roi and moves region to where the code is in it */
+static gboolean
+map_roi (RoiConverter * conv, TimeOverlayRegion * region, GstVideoFrame * roi)
+{
+  if (!gst_video_frame_map (roi, &conv->roi_info, conv->roi_buffer,
+          GST_MAP_READWRITE))
+    return FALSE;
+
+  region->x -= conv->area.x;
+  region->y -= conv->area.y;
+  return TRUE;
+}
+
+gboolean
+roi_converter_read (RoiConverter * conv, GstVideoFrame * frame,
+    TimeOverlayRegion * region, GstVideoFrame * roi)
+{
+  if (!ensure_converter (conv, &frame->info, region, FALSE) ||
+      !map_roi (conv, region, roi))
+    return FALSE;
+
+  gst_video_converter_frame (conv->from_frame, frame, roi);
+  return TRUE;
+}
+
+gboolean
+roi_converter_map (RoiConverter * conv, GstVideoFrame * frame,
+    TimeOverlayRegion * region, GstVideoFrame * roi)
+{
+  if (!ensure_converter (conv, &frame->info, region, TRUE) ||
+      !map_roi (conv, region, roi))
+    return FALSE;
+
+  if (conv->from_frame)
+    gst_video_converter_frame (conv->from_frame, frame, roi);
+  return TRUE;
+}
+
+void
+roi_converter_write (RoiConverter * conv, GstVideoFrame * roi,
+    GstVideoFrame * frame)
+{
+  gst_video_converter_frame (conv->to_frame, roi, frame);
+  gst_video_frame_unmap (roi);
+}
@@ -0,0 +1,72 @@
+/* GStreamer
+ * Copyright (C) 2016 William Manley <will@williammanley.net>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef _ROICONVERT_H_
+#define _ROICONVERT_H_
+
+#include <gst/video/video.h>
+
+#include "gsttimeoverlaycodec.h"
+
+G_BEGIN_DECLS
+
+/* Formats the elements draw into and read from directly */
+#define TIMEOVERLAY_NATIVE_FORMATS \
+    "{ RGB, BGR, BGRx, xBGR, RGBx, xRGB, RGB15, RGB16, YUY2, GRAY8 }"
+
+gboolean timeoverlay_format_is_native (GstVideoFormat format);
+
+/* Caps for the elements' pads: TIMEOVERLAY_NATIVE_FORMATS first, so that
+ * negotiation prefers them, then every format a RoiConverter can handle */
+GstCaps *timeoverlay_video_caps (void);
+
+/* Frames in any other format have just the code region converted to GRAY8
+ * and back, so that the cost is proportional to the code rather than the
+ * frame.  The region is grown to the format's chroma subsampling and pixel
+ * packing first, so that the conversion only ever touches whole samples.
+ * The converters are kept for as long as the caps and region stay the same.
+ * Only to be used from one thread at a time. */
+typedef struct {
+  GstVideoConverter *from_frame;
+  GstVideoConverter *to_frame;
+  GstVideoInfo frame_info;
+  TimeOverlayRegion region;
+  TimeOverlayRegion area;
+  gboolean drawing;
+  GstVideoInfo roi_info;
+  GstBuffer *roi_buffer;
+} RoiConverter;
+
+void roi_converter_clear (RoiConverter * conv);
+
+/* Converts the region of frame into roi, which must be unmapped after.
+ * region is moved to where the code is in roi. */
+gboolean roi_converter_read (RoiConverter * conv, GstVideoFrame * frame,
+    TimeOverlayRegion * region, GstVideoFrame * roi);
+
+/* Maps roi to draw the region into, moving region as roi_converter_read
+ * does, then roi_converter_write converts it into the frame and unmaps it */
+gboolean roi_converter_map (RoiConverter * conv, GstVideoFrame * frame,
+    TimeOverlayRegion * region, GstVideoFrame * roi);
+void roi_converter_write (RoiConverter * conv, GstVideoFrame * roi,
+    GstVideoFrame * frame);
+
+G_END_DECLS
+
+#endif
@@ -18,14 +18,38 @@
  * Boston, MA 02110-1301, USA.
  */
 
+#include <errno.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
 #include <gst/gst.h>
 
+#include "tracewriter.h"
+
+static gchar *trace_location = NULL;
+static gchar *hls_dir = NULL;
+static gint segment_duration = 2;
+static gdouble part_duration = 0.5;
+
+static GOptionEntry entries[] = {
+  { "hls", 0, 0, G_OPTION_ARG_FILENAME, &hls_dir,
+    "Encode the stamped video and write it to DIR as HLS instead of "
+    "displaying it.  The playlist is DIR/playlist.m3u8", "DIR" },
+  { "segment-duration", 0, 0, G_OPTION_ARG_INT, &segment_duration,
+    "Target duration of each --hls segment (default 2)", "SECONDS" },
+  { "part-duration", 0, 0, G_OPTION_ARG_DOUBLE, &part_duration,
+    "Keyframe interval of the --hls stream, the finest granularity segments "
+    "can be cut at (default 0.5)", "SECONDS" },
+  { "trace", 0, 0, G_OPTION_ARG_FILENAME, &trace_location,
+    "Write the times each frame was produced, drawn onto and rendered to "
+    "FILE as a Chrome/Perfetto JSON trace", "FILE" },
+  { NULL }
+};
+
 static gboolean bus_call (GstBus *bus, GstMessage *msg, gpointer data);
 static gchar* get_current_mode (void);
+static gchar *hls_sink_pipeline (const gchar *mode);
 
 int main(int argc, char* argv[])
 {
@@ -35,26 +59,51 @@ int main(int argc, char* argv[])
   GstElement * mmalvideosink;
   GstPipeline * pipeline;
   GError * err = NULL;
-  gchar * sink_pipeline, *pipeline_description;
+  gchar * sink_pipeline, *pipeline_description, *mode;
   struct timespec ts;
   int res;
   GstClock *clock;
+  GOptionContext *ctx;
+  TraceWriter *trace = NULL;
+
+  ctx = g_option_context_new ("[SINK-PIPELINE]");
+  g_option_context_add_main_entries (ctx, entries, NULL);
+  g_option_context_add_group (ctx, gst_init_get_option_group ());
+  if (!g_option_context_parse (ctx, &argc, &argv, &err)) {
+    fprintf(stderr, "Error parsing arguments: %s\n", err->message);
+    return 1;
+  }
+  g_option_context_free (ctx);
 
-  gst_init(&argc, &argv);
+  if (hls_dir && argc > 1) {
+    fprintf(stderr, "--hls and SINK-PIPELINE are mutually exclusive\n");
+    return 1;
+  }
+  if (segment_duration < 1 || part_duration <= 0 ||
+      part_duration > segment_duration) {
+    fprintf(stderr, "--part-duration must be positive and no longer than "
+        "--segment-duration\n");
+    return 1;
+  }
 
   loop = g_main_loop_new (NULL, FALSE);
 
+  mode = get_current_mode ();
   if (argc > 1)
     sink_pipeline = argv[1];
+  else if (hls_dir)
+    sink_pipeline = hls_sink_pipeline (mode);
   else
     sink_pipeline = "videoconvert ! mmalvideosink name=mmalsink";
+  if (!sink_pipeline)
+    return 1;
 
   pipeline_description = g_strdup_printf (
       "videotestsrc is-live=true pattern=white "
       "! %s "
       "! timestampoverlay "
       "! queue "
-      "! %s", get_current_mode(), sink_pipeline);
+      "! %s", mode, sink_pipeline);
   g_printerr ("Using pipeline %s\n", pipeline_description);
   epipeline = gst_parse_launch (pipeline_description, &err);
 
@@ -80,6 +129,15 @@ int main(int argc, char* argv[])
     mmalvideosink = NULL;
   }
 
+  if (trace_location) {
+    trace = trace_writer_new (trace_location, "server", &err);
+    if (!trace) {
+      fprintf(stderr, "%s\n", err->message);
+      return 1;
+    }
+    trace_writer_add_pipeline (trace, GST_BIN (pipeline), "produce");
+  }
+
   /* we add a message handler */
   bus = gst_pipeline_get_bus (GST_PIPELINE (pipeline));
   gst_bus_add_watch (bus, bus_call, loop);
@@ -100,6 +158,14 @@ int main(int argc, char* argv[])
 
   g_main_loop_run (loop);
 
+  if (trace) {
+    gst_element_set_state(epipeline, GST_STATE_NULL);
+    if (!trace_writer_close (trace, &err)) {
+      fprintf(stderr, "%s\n", err->message);
+      return 1;
+    }
+  }
+
   return 0;
 }
 
@@ -189,3 +255,51 @@ get_current_mode (void)
 error:
   return "video/x-raw,width=640,height=240,framerate=50/1";
 }
+
+/* Segments can only start on a keyframe, so the keyframe interval is the
+ * nearest thing hlssink2 has to LL-HLS parts.  The settings are written
+ * next to the playlist so that the client can label its statistics with
+ * them. */
+static gchar *
+hls_sink_pipeline (const gchar *mode)
+{
+  GstCaps *caps = gst_caps_from_string (mode);
+  GstStructure *settings;
+  gint fps_n = 50, fps_d = 1, key_int;
+  gchar *str, *filename;
+  GError *err = NULL;
+
+  if (caps) {
+    gst_structure_get_fraction (gst_caps_get_structure (caps, 0), "framerate",
+        &fps_n, &fps_d);
+    gst_caps_unref (caps);
+  }
+  key_int = MAX (1, (gint) round (part_duration * fps_n / fps_d));
+
+  if (g_mkdir_with_parents (hls_dir, 0755) != 0) {
+    fprintf(stderr, "Failed to create %s: %s\n", hls_dir,
+        g_strerror (errno));
+    return NULL;
+  }
+  filename = g_build_filename (hls_dir, "playlist.m3u8.settings", NULL);
+  settings = gst_structure_new ("hls",
+      "segment-duration", G_TYPE_INT, segment_duration,
+      "part-duration", G_TYPE_DOUBLE, part_duration,
+      "keyframe-interval", G_TYPE_INT, key_int, NULL);
+  str = gst_structure_to_string (settings);
+  if (!g_file_set_contents (filename, str, -1, &err)) {
+    fprintf(stderr, "Failed to write HLS settings: %s\n", err->message);
+    g_clear_error (&err);
+  }
+  g_free (str);
+  g_free (filename);
+  gst_structure_free (settings);
+
+  return g_strdup_printf (
+      "videoconvert "
+      "! x264enc tune=zerolatency speed-preset=ultrafast key-int-max=%d "
+      "! h264parse "
+      "! hlssink2 location=%s/segment%%05d.ts "
+      "    playlist-location=%s/playlist.m3u8 target-duration=%d",
+      key_int, hls_dir, hls_dir, segment_duration);
+}
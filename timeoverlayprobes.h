@@ -0,0 +1,66 @@
+/* GStreamer
+ * Copyright (C) 2016 William Manley <will@williammanley.net>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef _TIMEOVERLAY_PROBES_H_
+#define _TIMEOVERLAY_PROBES_H_
+
+/* USDT probes for correlating frames with scheduler and IRQ events using
+ * perf or bpftrace, e.g.
+ *
+ *   bpftrace -e 'usdt:./libgsttimeoverlayparse.so:latency_clock:parse
+ *       { printf ("%d %d\n", arg0, arg3); }'
+ *
+ * Each probe is a single nop until a tracer attaches to it.  All times are
+ * in nanoseconds and the sequence is -1 where the mode doesn't carry one.
+ *
+ *   stamp (sequence, clock_time, render_realtime)
+ *       timestampoverlay has drawn the code onto a frame
+ *   arrive (clock_time, arrival_time)
+ *       a frame has reached timeoverlayparse, before it is decoded
+ *   parse (sequence, clock_time, render_realtime, latency)
+ *       a frame has been decoded, by the element or by a pad probe
+ */
+
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+
+#define TIMEOVERLAY_PROBE_STAMP(sequence, clock_time, render_realtime) \
+    DTRACE_PROBE3 (latency_clock, stamp, (gint64) (sequence), \
+        (guint64) (clock_time), (guint64) (render_realtime))
+#define TIMEOVERLAY_PROBE_ARRIVE(clock_time, arrival_time) \
+    DTRACE_PROBE2 (latency_clock, arrive, (guint64) (clock_time), \
+        (guint64) (arrival_time))
+#define TIMEOVERLAY_PROBE_PARSE(sequence, clock_time, render_realtime, latency) \
+    DTRACE_PROBE4 (latency_clock, parse, (gint64) (sequence), \
+        (guint64) (clock_time), (guint64) (render_realtime), \
+        (gint64) (latency))
+#else
+/* The arguments are still referenced so that -Werror builds don't depend on
+ * whether sys/sdt.h is installed */
+#define TIMEOVERLAY_PROBE_STAMP(sequence, clock_time, render_realtime) \
+    G_STMT_START { (void) (sequence); (void) (clock_time); \
+      (void) (render_realtime); } G_STMT_END
+#define TIMEOVERLAY_PROBE_ARRIVE(clock_time, arrival_time) \
+    G_STMT_START { (void) (clock_time); (void) (arrival_time); } G_STMT_END
+#define TIMEOVERLAY_PROBE_PARSE(sequence, clock_time, render_realtime, latency) \
+    G_STMT_START { (void) (sequence); (void) (clock_time); \
+      (void) (render_realtime); (void) (latency); } G_STMT_END
+#endif
+
+#endif
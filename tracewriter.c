@@ -0,0 +1,573 @@
+/* GStreamer
+ * Copyright (C) 2016 William Manley <will@williammanley.net>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "tracewriter.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+
+/* Events each thread can have waiting for the flusher */
+#define TRACE_BUFFER_EVENTS 4096
+#define FLUSH_INTERVAL (100 * G_TIME_SPAN_MILLISECOND)
+
+typedef struct {
+  const gchar *name;
+  const gchar *element;
+  const gchar *arg_name;
+  gint64 start;
+  gint64 duration;
+  gint64 arg;
+} TraceEvent;
+
+/* head is only written by the thread that owns the buffer and tail only by
+ * the flusher, so each side just needs to see the other's index */
+typedef struct {
+  TraceEvent events[TRACE_BUFFER_EVENTS];
+  gint head;
+  gint tail;
+  gint dropped;
+  gint tid;
+  gchar thread_name[16];
+  gboolean described;
+} TraceBuffer;
+
+struct _TraceWriter {
+  FILE *file;
+  gint generation;
+  gint pid;
+  gint error;
+  gboolean first;
+
+  /* Protects the list of buffers and quit */
+  GMutex lock;
+  GCond cond;
+  GPtrArray *buffers;
+  gboolean quit;
+  GThread *flusher;
+};
+
+/* The calling thread's buffer, which belongs to the writer with the given
+ * generation.  Writers are numbered so that a thread that outlives one
+ * writer doesn't use its freed buffer with the next. */
+typedef struct {
+  gint generation;
+  TraceBuffer *buffer;
+} ThreadTrace;
+
+static GPrivate thread_trace = G_PRIVATE_INIT (g_free);
+static gint last_generation = 0;
+
+static TraceBuffer *
+get_thread_buffer (TraceWriter * writer)
+{
+  ThreadTrace *trace = g_private_get (&thread_trace);
+  TraceBuffer *buffer;
+
+  if (trace && trace->generation == writer->generation)
+    return trace->buffer;
+
+  if (!trace) {
+    trace = g_new0 (ThreadTrace, 1);
+    g_private_set (&thread_trace, trace);
+  }
+
+  buffer = g_new0 (TraceBuffer, 1);
+  buffer->tid = syscall (SYS_gettid);
+  /* GStreamer names its streaming threads after the pad, e.g. "v4l2src0:src" */
+  if (prctl (PR_GET_NAME, buffer->thread_name) != 0)
+    buffer->thread_name[0] = '\0';
+
+  g_mutex_lock (&writer->lock);
+  g_ptr_array_add (writer->buffers, buffer);
+  g_mutex_unlock (&writer->lock);
+
+  trace->generation = writer->generation;
+  trace->buffer = buffer;
+  return buffer;
+}
+
+void
+trace_writer_add_span (TraceWriter * writer, const gchar * name,
+    const gchar * element, gint64 start, gint64 duration,
+    const gchar * arg_name, gint64 arg)
+{
+  TraceBuffer *buffer = get_thread_buffer (writer);
+  guint head = buffer->head;
+  TraceEvent *event;
+
+  if (head - (guint) g_atomic_int_get (&buffer->tail) >= TRACE_BUFFER_EVENTS) {
+    g_atomic_int_inc (&buffer->dropped);
+    return;
+  }
+
+  event = &buffer->events[head % TRACE_BUFFER_EVENTS];
+  event->name = name;
+  event->element = element;
+  event->arg_name = arg_name;
+  event->start = start;
+  event->duration = duration;
+  event->arg = arg;
+  g_atomic_int_set (&buffer->head, head + 1);
+}
+
+static void
+write_string (FILE * file, const gchar * s)
+{
+  fputc ('"', file);
+  for (; *s; s++) {
+    if (*s == '"' || *s == '\\')
+      fprintf (file, "\\%c", *s);
+    else if ((guchar) *s < 0x20)
+      fprintf (file, "\\u%04x", (guchar) *s);
+    else
+      fputc (*s, file);
+  }
+  fputc ('"', file);
+}
+
+static void
+begin_event (TraceWriter * writer)
+{
+  fputs (writer->first ? "\n" : ",\n", writer->file);
+  writer->first = FALSE;
+}
+
+static void
+write_thread_name (TraceWriter * writer, TraceBuffer * buffer)
+{
+  begin_event (writer);
+  fprintf (writer->file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,"
+      "\"tid\":%d,\"args\":{\"name\":", writer->pid, buffer->tid);
+  write_string (writer->file, buffer->thread_name);
+  fputs ("}}", writer->file);
+}
+
+static void
+write_event (TraceWriter * writer, TraceBuffer * buffer,
+    const TraceEvent * event)
+{
+  begin_event (writer);
+  fprintf (writer->file, "{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%"
+      G_GINT64_FORMAT ",\"dur\":%" G_GINT64_FORMAT ",\"pid\":%d,\"tid\":%d,"
+      "\"args\":{\"%s\":%" G_GINT64_FORMAT, event->name, event->start,
+      event->duration, writer->pid, buffer->tid, event->arg_name, event->arg);
+  if (event->element) {
+    fputs (",\"element\":", writer->file);
+    write_string (writer->file, event->element);
+  }
+  fputs ("}}", writer->file);
+}
+
+/* Only called from the flusher, or from close once it has stopped */
+static void
+drain (TraceWriter * writer)
+{
+  TraceBuffer **buffers, *buffer;
+  guint n, n_buffers, head, tail;
+
+  g_mutex_lock (&writer->lock);
+  n_buffers = writer->buffers->len;
+  buffers = g_new (TraceBuffer *, n_buffers);
+  memcpy (buffers, writer->buffers->pdata, n_buffers * sizeof (gpointer));
+  g_mutex_unlock (&writer->lock);
+
+  for (n = 0; n < n_buffers; n++) {
+    buffer = buffers[n];
+    if (!buffer->described) {
+      write_thread_name (writer, buffer);
+      buffer->described = TRUE;
+    }
+
+    head = g_atomic_int_get (&buffer->head);
+    for (tail = buffer->tail; tail != head; tail++)
+      write_event (writer, buffer,
+          &buffer->events[tail % TRACE_BUFFER_EVENTS]);
+    g_atomic_int_set (&buffer->tail, tail);
+  }
+  g_free (buffers);
+
+  if ((fflush (writer->file) != 0 || ferror (writer->file)) && !writer->error)
+    writer->error = errno ? errno : EIO;
+}
+
+static gpointer
+flush_thread (gpointer data)
+{
+  TraceWriter *writer = data;
+
+  g_mutex_lock (&writer->lock);
+  while (!writer->quit) {
+    g_cond_wait_until (&writer->cond, &writer->lock,
+        g_get_monotonic_time () + FLUSH_INTERVAL);
+    g_mutex_unlock (&writer->lock);
+    drain (writer);
+    g_mutex_lock (&writer->lock);
+  }
+  g_mutex_unlock (&writer->lock);
+  return NULL;
+}
+
+TraceWriter *
+trace_writer_new (const gchar * filename, const gchar * process_name,
+    GError ** err)
+{
+  TraceWriter *writer;
+  FILE *file;
+
+  file = fopen (filename, "w");
+  if (!file) {
+    g_set_error (err, G_FILE_ERROR, g_file_error_from_errno (errno),
+        "Failed to create %s: %s", filename, g_strerror (errno));
+    return NULL;
+  }
+
+  writer = g_new0 (TraceWriter, 1);
+  writer->file = file;
+  writer->generation = g_atomic_int_add (&last_generation, 1) + 1;
+  writer->pid = getpid ();
+  writer->buffers = g_ptr_array_new_with_free_func (g_free);
+  g_mutex_init (&writer->lock);
+  g_cond_init (&writer->cond);
+
+  /* The JSON array form, which trace viewers still load if the closing
+   * bracket is missing because the process was killed */
+  fputs ("[", file);
+  writer->first = TRUE;
+  begin_event (writer);
+  fprintf (file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,"
+      "\"args\":{\"name\":", writer->pid);
+  write_string (file, process_name);
+  fputs ("}}", file);
+
+  writer->flusher = g_thread_new ("tracewriter", flush_thread, writer);
+  return writer;
+}
+
+gboolean
+trace_writer_close (TraceWriter * writer, GError ** err)
+{
+  guint n;
+  gint64 dropped = 0;
+  gboolean ret = TRUE;
+
+  g_mutex_lock (&writer->lock);
+  writer->quit = TRUE;
+  g_cond_signal (&writer->cond);
+  g_mutex_unlock (&writer->lock);
+  g_thread_join (writer->flusher);
+
+  drain (writer);
+  for (n = 0; n < writer->buffers->len; n++)
+    dropped += g_atomic_int_get (&((TraceBuffer *)
+            g_ptr_array_index (writer->buffers, n))->dropped);
+  if (dropped > 0) {
+    begin_event (writer);
+    fprintf (writer->file, "{\"name\":\"dropped events\",\"ph\":\"i\","
+        "\"s\":\"g\",\"ts\":%" G_GINT64_FORMAT ",\"pid\":%d,\"tid\":0,"
+        "\"args\":{\"count\":%" G_GINT64_FORMAT "}}", g_get_real_time (),
+        writer->pid, dropped);
+  }
+  fputs ("\n]\n", writer->file);
+
+  if (fclose (writer->file) != 0 && !writer->error)
+    writer->error = errno;
+  if (writer->error) {
+    g_set_error (err, G_FILE_ERROR, g_file_error_from_errno (writer->error),
+        "Failed to write trace: %s", g_strerror (writer->error));
+    ret = FALSE;
+  }
+
+  g_ptr_array_unref (writer->buffers);
+  g_mutex_clear (&writer->lock);
+  g_cond_clear (&writer->cond);
+  g_free (writer);
+  return ret;
+}
+
+/* Pipeline tracing */
+
+typedef struct {
+  TraceWriter *writer;
+  const gchar *span;
+  const gchar *element;
+  GstSegment segment;
+  /* When the buffer being processed reached the sink pad, for draw */
+  gint64 start;
+  /* Pipeline latency in microseconds, for render */
+  gint latency;
+  gint refcount;
+} PadTrace;
+
+static PadTrace *
+pad_trace_new (TraceWriter * writer, const gchar * span, GstElement * element)
+{
+  PadTrace *trace = g_slice_new0 (PadTrace);
+
+  trace->writer = writer;
+  trace->span = span;
+  trace->element = g_intern_string (GST_OBJECT_NAME (element));
+  gst_segment_init (&trace->segment, GST_FORMAT_TIME);
+  trace->refcount = 1;
+  return trace;
+}
+
+static void
+pad_trace_unref (gpointer data)
+{
+  PadTrace *trace = data;
+
+  if (g_atomic_int_dec_and_test (&trace->refcount))
+    g_slice_free (PadTrace, trace);
+}
+
+static void
+update_segment (PadTrace * trace, GstEvent * event)
+{
+  const GstSegment *segment;
+
+  if (GST_EVENT_TYPE (event) != GST_EVENT_SEGMENT)
+    return;
+  gst_event_parse_segment (event, &segment);
+  gst_segment_copy_into (segment, &trace->segment);
+}
+
+/* The clock time of the buffer's timestamp as REALTIME microseconds, or -1 */
+static gint64
+buffer_realtime (PadTrace * trace, GstElement * element, GstBuffer * buffer,
+    GstClockTime offset)
+{
+  GstClockTime pts = GST_BUFFER_PTS (buffer), running_time;
+  GstClock *clock;
+  GstClockTimeDiff diff;
+  gint64 now;
+
+  if (!GST_CLOCK_TIME_IS_VALID (pts) ||
+      trace->segment.format != GST_FORMAT_TIME)
+    return -1;
+  running_time = gst_segment_to_running_time (&trace->segment,
+      GST_FORMAT_TIME, pts);
+  clock = gst_element_get_clock (element);
+  if (!GST_CLOCK_TIME_IS_VALID (running_time) || !clock) {
+    if (clock)
+      gst_object_unref (clock);
+    return -1;
+  }
+
+  diff = GST_CLOCK_DIFF (gst_clock_get_time (clock),
+      running_time + gst_element_get_base_time (element) + offset);
+  now = g_get_real_time ();
+  gst_object_unref (clock);
+  return now + diff / 1000;
+}
+
+static void
+add_buffer_span (PadTrace * trace, GstBuffer * buffer, gint64 start,
+    gint64 end)
+{
+  trace_writer_add_span (trace->writer, trace->span, trace->element, start,
+      MAX (end - start, 0), "pts", GST_BUFFER_PTS (buffer));
+}
+
+/* From the buffer's timestamp to it leaving the source */
+static GstPadProbeReturn
+source_probe (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+  PadTrace *trace = user_data;
+  GstBuffer *buffer;
+  gint64 start;
+
+  if (info->type & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM) {
+    update_segment (trace, GST_PAD_PROBE_INFO_EVENT (info));
+    return GST_PAD_PROBE_OK;
+  }
+
+  buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+  start = buffer_realtime (trace, GST_PAD_PARENT (pad), buffer, 0);
+  if (start >= 0)
+    add_buffer_span (trace, buffer, start, g_get_real_time ());
+  return GST_PAD_PROBE_OK;
+}
+
+/* Transforms are timed from the buffer arriving at the sink pad to it
+ * leaving the source pad */
+static GstPadProbeReturn
+transform_sink_probe (GstPad * pad, GstPadProbeInfo * info,
+    gpointer user_data)
+{
+  PadTrace *trace = user_data;
+
+  trace->start = g_get_real_time ();
+  return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn
+transform_src_probe (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+  PadTrace *trace = user_data;
+
+  if (trace->start > 0)
+    add_buffer_span (trace, GST_PAD_PROBE_INFO_BUFFER (info), trace->start,
+        g_get_real_time ());
+  trace->start = 0;
+  return GST_PAD_PROBE_OK;
+}
+
+/* From the buffer reaching the sink to the time it is due to be rendered.
+ * The latency is caught on its way upstream from the sink. */
+static GstPadProbeReturn
+render_probe (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+  PadTrace *trace = user_data;
+  GstClockTime latency;
+  GstBuffer *buffer;
+  gint64 now, end;
+
+  if (info->type & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM) {
+    update_segment (trace, GST_PAD_PROBE_INFO_EVENT (info));
+    return GST_PAD_PROBE_OK;
+  }
+  if (info->type & GST_PAD_PROBE_TYPE_EVENT_UPSTREAM) {
+    if (GST_EVENT_TYPE (GST_PAD_PROBE_INFO_EVENT (info)) == GST_EVENT_LATENCY) {
+      gst_event_parse_latency (GST_PAD_PROBE_INFO_EVENT (info), &latency);
+      g_atomic_int_set (&trace->latency, latency / GST_USECOND);
+    }
+    return GST_PAD_PROBE_OK;
+  }
+
+  buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+  now = g_get_real_time ();
+  end = buffer_realtime (trace, GST_PAD_PARENT (pad), buffer,
+      g_atomic_int_get (&trace->latency) * GST_USECOND);
+  if (end >= 0)
+    add_buffer_span (trace, buffer, now, end);
+  return GST_PAD_PROBE_OK;
+}
+
+static void
+add_probe (GstElement * element, const gchar * pad_name,
+    GstPadProbeType type, GstPadProbeCallback callback, PadTrace * trace)
+{
+  GstPad *pad = gst_element_get_static_pad (element, pad_name);
+
+  if (!pad) {
+    pad_trace_unref (trace);
+    return;
+  }
+  gst_pad_add_probe (pad, type, callback, trace, pad_trace_unref);
+  gst_object_unref (pad);
+}
+
+static gboolean
+has_pad (GstElement * element, const gchar * name)
+{
+  GstPad *pad = gst_element_get_static_pad (element, name);
+
+  if (pad)
+    gst_object_unref (pad);
+  return pad != NULL;
+}
+
+/* Sources and sinks that are bins, like autovideosink, are traced at their
+ * ghost pads, as the element inside may not have been created yet */
+static gboolean
+inside_traced_bin (GstElement * element, GstBin * top, GstElementFlags flag,
+    const gchar * pad_name)
+{
+  GstObject *parent;
+
+  for (parent = GST_OBJECT_PARENT (element);
+      parent && parent != GST_OBJECT (top); parent = GST_OBJECT_PARENT (parent))
+    if (GST_OBJECT_FLAG_IS_SET (parent, flag) &&
+        has_pad (GST_ELEMENT (parent), pad_name))
+      return TRUE;
+  return FALSE;
+}
+
+static gboolean
+syncs_to_clock (GstElement * element)
+{
+  gboolean sync = TRUE;
+
+  if (g_object_class_find_property (G_OBJECT_GET_CLASS (element), "sync"))
+    g_object_get (element, "sync", &sync, NULL);
+  return sync;
+}
+
+typedef struct {
+  TraceWriter *writer;
+  GstBin *bin;
+  const gchar *source_span;
+} PipelineTrace;
+
+static void
+trace_element (const GValue * item, gpointer user_data)
+{
+  PipelineTrace *pipeline = user_data;
+  GstElement *element = g_value_get_object (item);
+  GstElementFactory *factory = gst_element_get_factory (element);
+  const gchar *factory_name = factory ?
+      gst_plugin_feature_get_name (GST_PLUGIN_FEATURE (factory)) : "";
+  const gchar *span = NULL;
+  PadTrace *trace;
+
+  if (g_str_equal (factory_name, "timestampoverlay"))
+    span = "draw";
+
+  if (span) {
+    trace = pad_trace_new (pipeline->writer, span, element);
+    g_atomic_int_inc (&trace->refcount);
+    add_probe (element, "sink", GST_PAD_PROBE_TYPE_BUFFER,
+        transform_sink_probe, trace);
+    add_probe (element, "src", GST_PAD_PROBE_TYPE_BUFFER,
+        transform_src_probe, trace);
+  } else if (GST_OBJECT_FLAG_IS_SET (element, GST_ELEMENT_FLAG_SOURCE) &&
+      !inside_traced_bin (element, pipeline->bin, GST_ELEMENT_FLAG_SOURCE,
+          "src")) {
+    add_probe (element, "src", GST_PAD_PROBE_TYPE_BUFFER |
+        GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, source_probe,
+        pad_trace_new (pipeline->writer, pipeline->source_span, element));
+  } else if (GST_OBJECT_FLAG_IS_SET (element, GST_ELEMENT_FLAG_SINK) &&
+      !inside_traced_bin (element, pipeline->bin, GST_ELEMENT_FLAG_SINK,
+          "sink") && syncs_to_clock (element)) {
+    add_probe (element, "sink", GST_PAD_PROBE_TYPE_BUFFER |
+        GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM |
+        GST_PAD_PROBE_TYPE_EVENT_UPSTREAM, render_probe,
+        pad_trace_new (pipeline->writer, "render", element));
+  }
+}
+
+void
+trace_writer_add_pipeline (TraceWriter * writer, GstBin * bin,
+    const gchar * source_span)
+{
+  PipelineTrace pipeline = { writer, bin, source_span };
+  GstIterator *it = gst_bin_iterate_recurse (bin);
+
+  gst_iterator_foreach (it, trace_element, &pipeline);
+  gst_iterator_free (it);
+}
@@ -0,0 +1,65 @@
+/* GStreamer
+ * Copyright (C) 2016 William Manley <will@williammanley.net>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef _TRACEWRITER_H_
+#define _TRACEWRITER_H_
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/* Per-frame events in Chrome's JSON trace format, for loading into Perfetto
+ * or chrome://tracing.  Times are microseconds of REALTIME, so the traces of
+ * a server and a client with synchronised clocks line up when merged.
+ *
+ * Each thread that adds events gets its own single-producer ring buffer, so
+ * adding an event never takes a lock.  A background thread drains the
+ * buffers into the file a few times a second.  If a buffer fills up before
+ * it is drained, events are dropped and the count is written to the trace.
+ *
+ * name, element and arg_name must stay valid until the writer is closed,
+ * e.g. string literals or interned strings.  element may be NULL. */
+typedef struct _TraceWriter TraceWriter;
+
+TraceWriter *trace_writer_new (const gchar * filename,
+    const gchar * process_name, GError ** err);
+void trace_writer_add_span (TraceWriter * writer, const gchar * name,
+    const gchar * element, gint64 start, gint64 duration,
+    const gchar * arg_name, gint64 arg);
+/* Writes out any remaining events and frees the writer */
+gboolean trace_writer_close (TraceWriter * writer, GError ** err);
+
+/* Adds pad probes to the elements of bin, recursively, for spans of
+ *
+ *   source_span   from a buffer's timestamp to it leaving a source element
+ *   "draw"        each buffer through timestampoverlay
+ *   "render"      from a buffer reaching a sink to the time it is rendered,
+ *                 for sinks that sync to the clock
+ *
+ * timeoverlayparse isn't traced here: in its async and pool decode modes a
+ * buffer leaves it before being decoded.  Its post-messages give the time
+ * decoding took instead.
+ *
+ * Must be called before the pipeline goes to PAUSED. */
+void trace_writer_add_pipeline (TraceWriter * writer, GstBin * bin,
+    const gchar * source_span);
+
+G_END_DECLS
+
+#endif